@@ -0,0 +1,30 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file CacheStats.h
+ **/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace acl
+{
+
+/**
+ * @brief Snapshot of a cache's counters
+ */
+struct CacheStats {
+    uint64_t hits = 0;                      //<! get_value() calls that found their key
+    uint64_t misses = 0;                    //<! get_value() calls that did not
+    uint64_t evictions = 0;                 //<! Entries booted to make room
+    uint64_t rejections = 0;                //<! New entries refused by the TinyLFU admission filter
+    size_t entries = 0;                     //<! Entries currently cached
+    size_t weight = 0;                      //<! Total weight currently cached
+};
+
+}
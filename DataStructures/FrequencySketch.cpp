@@ -0,0 +1,136 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file FrequencySketch.cpp
+ **/
+
+#include "FrequencySketch.h"
+
+#include <algorithm>
+
+namespace acl
+{
+    /**
+     * Seeds that give each row of the sketch an independent hash
+     */
+    static const uint64_t g_seeds[4] = {
+        0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+        0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+    };
+
+    /**
+     * Constructor
+     *
+     * @param capacity Number of distinct entries to track, usually the cache size
+     */
+    FrequencySketch::FrequencySketch( size_t capacity )
+    {
+        ensure_capacity(capacity);
+    }
+
+    /**
+     * Resizes the sketch for at least capacity entries.  Growing clears the
+     * counts; shrinking is ignored.
+     */
+    void FrequencySketch::ensure_capacity( size_t capacity )
+    {
+        capacity = std::max<size_t>(capacity, 16);
+        if( capacity <= m_capacity ){
+            return;
+        }
+
+        // Four counters per entry, rounded up to a power of two
+        size_t counters = 64;
+        while( counters < capacity * 4 ){
+            counters <<= 1;
+        }
+
+        m_table.assign(counters / 16, 0);
+        m_counterMask = counters - 1;
+        m_capacity = capacity;
+        m_sampleSize = capacity * 10;
+        m_additions = 0;
+    }
+
+    /**
+     * Returns the number of entries the sketch is sized for
+     */
+    size_t FrequencySketch::capacity() const
+    {
+        return m_capacity;
+    }
+
+    /**
+     * Counts one access to the entry with this hash
+     */
+    void FrequencySketch::increment( uint64_t hash )
+    {
+        bool added = false;
+
+        for( unsigned row = 0; row < 4; row++ ){
+            size_t index = counter_index(hash, row);
+            uint64_t& word = m_table[index >> 4];
+            unsigned shift = (index & 15) << 2;
+            if( ((word >> shift) & 0xf) != 0xf ){
+                word += (uint64_t)1 << shift;
+                added = true;
+            }
+        }
+
+        if( added && ++m_additions >= m_sampleSize ){
+            age();
+        }
+    }
+
+    /**
+     * Returns the estimated number of recent accesses, 0 to 15
+     */
+    unsigned FrequencySketch::frequency( uint64_t hash ) const
+    {
+        unsigned freq = 0xf;
+
+        for( unsigned row = 0; row < 4; row++ ){
+            size_t index = counter_index(hash, row);
+            unsigned shift = (index & 15) << 2;
+            freq = std::min(freq, (unsigned)((m_table[index >> 4] >> shift) & 0xf));
+        }
+        return freq;
+    }
+
+    /**
+     * Zeroes every counter
+     */
+    void FrequencySketch::clear()
+    {
+        std::fill(m_table.begin(), m_table.end(), 0);
+        m_additions = 0;
+    }
+
+    /**
+     * Picks the counter for one row.  The hash is scrambled with the row's
+     * seed so weak hashes (such as the identity hash of integers) still
+     * spread over the table.
+     */
+    size_t FrequencySketch::counter_index( uint64_t hash, unsigned row ) const
+    {
+        uint64_t h = (hash + g_seeds[row]) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 29;
+        return (size_t)h & m_counterMask;
+    }
+
+    /**
+     * Halves every counter so that past popularity decays
+     */
+    void FrequencySketch::age()
+    {
+        for( auto& word : m_table ){
+            word = (word >> 1) & 0x7777777777777777ULL;
+        }
+        m_additions /= 2;
+    }
+}
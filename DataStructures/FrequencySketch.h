@@ -0,0 +1,50 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file FrequencySketch.h
+ **/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace acl
+{
+    /**
+     * @class FrequencySketch
+     *
+     * @brief Approximate access counts for the TinyLFU cache admission filter
+     *
+     * A count-min sketch of 4-bit counters: each hash bumps four counters
+     * and its frequency is the smallest of them, so collisions can only
+     * overestimate.  Once the number of increments reaches ten times the
+     * capacity every counter is halved, so old popularity fades.  Not
+     * thread safe; callers lock around it.
+     */
+    class FrequencySketch
+    {
+        public:
+            FrequencySketch( size_t capacity = 0 );
+
+            void ensure_capacity( size_t capacity );
+            size_t capacity() const;
+            void increment( uint64_t hash );
+            unsigned frequency( uint64_t hash ) const;
+            void clear();
+
+        private:
+            size_t counter_index( uint64_t hash, unsigned row ) const;
+            void age();
+
+            std::vector<uint64_t> m_table;  //!< Brief 16 4-bit counters per word
+            size_t m_counterMask = 0;       //!< Brief number of counters - 1
+            size_t m_capacity = 0;          //!< Brief entries the sketch is sized for
+            size_t m_additions = 0;         //!< Brief increments since the last aging
+            size_t m_sampleSize = 0;        //!< Brief increments between agings
+    };
+}
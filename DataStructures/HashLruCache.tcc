@@ -0,0 +1,938 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file HashLruCache.tcc
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "CacheStats.h"
+#include "FrequencySketch.h"
+#include "JobGroup.h"
+#include "TaskManager.tcc"
+#include "shared_mutex.h"
+
+namespace acl
+{
+
+/**
+ * @brief How a cache picks which entries to keep
+ */
+enum class EvictionPolicy {
+    LRU,        //<! Evict the least recently used entry
+    SLRU,       //<! Segmented LRU: entries hit since being added are protected from newer ones
+    TINY_LFU    //<! SLRU, and a new entry is only admitted if it is used more often than its victim
+};
+
+// With DEBUG_CACHE the cache lock records contention in the LockRegistry
+#ifdef DEBUG_CACHE
+typedef AclMutex CacheMutex;
+#else
+typedef std::mutex CacheMutex;
+#endif
+
+/**
+ * @brief A thread-safe LRU cache with O(1) lookups
+ *
+ * Same interface and eviction rules as LruCache, but the key index is an
+ * unordered_map and the recency list is an intrusive doubly linked list of
+ * indices into a node pool, so a hit costs one hash lookup and a few index
+ * writes instead of a std::map walk and shared_ptr/weak_ptr traffic.  Freed
+ * nodes are recycled through a free list, and set_max_size() reserves the
+ * pool and index up front.  Keys are unordered, so there is no
+ * get_lower_bound().
+ *
+ * Capacity is an entry count (set_max_size) and, optionally, a total weight
+ * (set_max_weight) measured by a weight function such as the size of the
+ * value in bytes.  Entries are evicted until both limits are met.
+ *
+ * The eviction policy makes the cache scan resistant.  Under SLRU new
+ * entries start in a probationary segment and move to a protected segment
+ * (at most 80% of the capacity) when they are hit, so a burst of keys that
+ * are used once only displaces other probationary entries.  TINY_LFU adds
+ * an admission filter on top: a FrequencySketch counts recent accesses to
+ * every key, cached or not, and a new entry that would force an eviction
+ * is refused unless its key has been used more often than the victim's.
+ *
+ * By default every hit relinks its node, so lookups take the lock
+ * exclusively.  With setClockRecency(true) a hit only sets the node's
+ * reference bit under a shared lock, so concurrent hits do not serialize.
+ * That needs a lock that can be shared: CLOCK is only available when Mutex
+ * is acl::shared_mutex, and setClockRecency(true) fails otherwise.  Eviction then gives
+ * referenced nodes a second chance (CLOCK): a victim whose bit is set has
+ * it cleared and is treated as hit instead (moved to the back, or promoted
+ * under SLRU).  Recency is approximate, but a node hit since the last
+ * sweep is never evicted ahead of one that was not.  CLOCK hits and misses
+ * never reach the TinyLFU sketch, so CLOCK recency cannot be combined with
+ * TINY_LFU.  The default Mutex is a plain mutex, which keeps the exclusive
+ * path cheap for caches that do not use CLOCK.  Declare the cache as
+ * HashLruCache<K, V, Hash, acl::shared_mutex> to use CLOCK.
+ *
+ * The cleanup handler normally runs on the inserting thread.  After
+ * startAsyncCleanup() evicted entries are handed to a bounded queue served
+ * by background workers instead, so an expensive handler (flushing to
+ * disk, say) does not stall add_to_cache().  When the queue is full the
+ * inserting thread runs the handler itself, which slows producers down to
+ * the rate the handler can keep up with.  An entry whose handler refuses
+ * the eviction is put back, possibly over capacity until the next insert.
+ * So is an entry whose handler throws: on a worker the exception is logged
+ * and dropped, on the inserting thread it propagates from add_to_cache().
+ *
+ * get_or_load() fills misses through a loader function and runs it only
+ * once per key at a time: concurrent callers missing the same key wait for
+ * the first caller's result instead of computing it again.
+ *
+ * @tparam K The key class used to access elements
+ * @tparam V The cached object type
+ * @tparam Hash Hash function for K
+ * @tparam Mutex The cache lock; acl::shared_mutex lets CLOCK hits share it
+ */
+template<class K, class V, class Hash = std::hash<K>, class Mutex = CacheMutex> class HashLruCache
+{
+public:
+    typedef Mutex mutex_type;
+
+    HashLruCache(size_t maxSize = SIZE_MAX);
+    virtual ~HashLruCache();
+    virtual bool add_to_cache(K, V);
+    virtual bool get_value(K, V&);
+    virtual V get_or_load(K key, std::function<V(void)> loader);
+    virtual void empty_cache();
+    virtual void setCleanupHandler(std::function<bool(K, V)> handler=nullptr);
+    virtual bool startAsyncCleanup(unsigned numThreads = 1, size_t maxPending = 1024);
+    virtual bool startAsyncCleanup(std::shared_ptr<ThreadPool> pool);
+    virtual void stopAsyncCleanup();
+    virtual size_t size();
+    virtual void set_max_size(size_t);
+    virtual size_t get_max_size();
+    virtual void setWeightFunction(std::function<size_t(const K&, const V&)> weigher=nullptr);
+    virtual void set_max_weight(size_t);
+    virtual size_t get_max_weight();
+    virtual void set_max_entry_weight(size_t);
+    virtual size_t get_weight();
+    virtual CacheStats get_stats();
+    virtual void reset_stats();
+    virtual bool setEvictionPolicy(EvictionPolicy policy);
+    virtual EvictionPolicy getEvictionPolicy();
+    virtual bool setClockRecency(bool enable);
+    virtual bool getClockRecency();
+    void set_lock_name(const std::string& name);
+
+protected:
+    static const size_t NIL = SIZE_MAX;    //<! Null node index
+    static const int PROBATION = 0;        //<! Segment for new entries, and every entry under LRU
+    static const int PROTECTED = 1;        //<! Segment for SLRU entries hit since they were added
+
+    //! Locks m shared if Mutex supports it, exclusively otherwise
+    typedef typename std::conditional<std::is_same<Mutex, acl::shared_mutex>::value,
+            acl::shared_lock, std::unique_lock<Mutex>>::type read_lock;
+
+    static void name_lock(acl::shared_mutex& lock, const std::string& name) { lock.set_lock_name(name); }
+#ifdef DEBUG_CACHE
+    static void name_lock(AclMutex& lock, const std::string& name) { lock.set_name(name); }
+#endif
+    template<class Lock> static void name_lock(Lock&, const std::string&) {}
+
+    /**
+     * @brief Reference bit set by hits under the shared lock.  Copyable so
+     *        the pool can grow, which only happens under the exclusive lock.
+     */
+    struct RefBit {
+        std::atomic_bool bit;
+        RefBit(): bit(false) {}
+        RefBit(const RefBit& other): bit(other.bit.load(std::memory_order_relaxed)) {}
+        RefBit& operator=(const RefBit& other)
+        {
+            bit.store(other.bit.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+    };
+
+    /**
+     * @brief One cache entry, linked by pool index
+     */
+    struct Node {
+        K key;
+        V value;
+        size_t weight;                      //<! Weight counted against m_maxWeight
+        int segment;                        //<! PROBATION or PROTECTED
+        size_t prev;                        //<! Node used less recently, or the next free node
+        size_t next;                        //<! Node used more recently
+        RefBit referenced;                  //<! Hit since the last CLOCK sweep
+    };
+
+    // List primitives.  These assume m is held.
+    size_t alloc_node(K&& key, V&& value, size_t weight); //<! Takes a node from the free list or grows the pool
+    void free_node(size_t index);           //<! Returns a node to the free list
+    void link_back(size_t index, int segment); //<! Links a node in as a segment's most recently used
+    void unlink(size_t index);              //<! Removes a node from its segment
+    void touch(size_t index);               //<! Records a hit on a node
+    size_t victim();                        //<! Returns the next node to evict
+    bool over_capacity(size_t incoming) const; //<! True if an entry of this weight does not fit
+    bool protected_full() const;            //<! True if the protected segment is over its share
+    bool peek(const K& key, V& val);        //<! Reads a value without counting or recording a hit
+    bool restore(K&& key, V&& value, size_t weight); //<! Puts back an entry whose eviction was refused
+    void cleanup(std::shared_ptr<std::pair<K, V>> entry, size_t weight,
+                 std::function<bool(K, V)> handler); //<! Runs the handler on a background worker
+
+    mutex_type m;                           //<! Guards everything below; shared for CLOCK hits
+    std::vector<Node> m_pool;               //<! Node storage; indices stay valid as it grows
+    std::unordered_map<K, size_t, Hash> m_index; //<! Key to pool index
+    size_t m_free = NIL;                    //<! Head of the free list, linked through prev
+    size_t m_head[2] = {NIL, NIL};          //<! Least recently used node of each segment
+    size_t m_tail[2] = {NIL, NIL};          //<! Most recently used node of each segment
+    size_t m_segLength[2] = {0, 0};         //<! Entries in each segment
+    size_t m_segWeight[2] = {0, 0};         //<! Weight of each segment
+    size_t m_length = 0;                    //<! Number of cached entries
+    size_t m_maxSize;                       //<! Capacity in entries
+    size_t m_weight = 0;                    //<! Total weight of cached entries
+    size_t m_maxWeight = SIZE_MAX;          //<! Capacity in weight
+    size_t m_maxEntryWeight = 0;            //<! Heaviest entry admitted, if over m_maxWeight
+    CacheStats m_stats;                     //<! Eviction and rejection counters
+    std::atomic<uint64_t> m_hits;           //<! Hits, counted under either lock
+    std::atomic<uint64_t> m_misses;         //<! Misses, counted under either lock
+    std::atomic_bool m_clock;               //<! Hits set reference bits instead of relinking
+    EvictionPolicy m_policy = EvictionPolicy::LRU; //<! How entries are admitted and evicted
+    FrequencySketch m_sketch;               //<! Access counts for TINY_LFU admission
+    std::function<bool(K, V)> m_cleanupHandler;
+    JobGroup m_cleanupJobs;                 //<! Runs the cleanup handler after startAsyncCleanup()
+    std::function<size_t(const K&, const V&)> m_weigher; //<! Weighs new entries; each weighs 1 if unset
+
+    TaskManager<K, V, std::unordered_map<K, std::shared_future<V>, Hash>> m_loads; //<! get_or_load() calls in flight
+};
+
+template<class K, class V, class Hash, class Mutex> const size_t HashLruCache<K,V,Hash,Mutex>::NIL;
+template<class K, class V, class Hash, class Mutex> const int HashLruCache<K,V,Hash,Mutex>::PROBATION;
+template<class K, class V, class Hash, class Mutex> const int HashLruCache<K,V,Hash,Mutex>::PROTECTED;
+
+/**
+ * @brief Constructor
+ *
+ * @param maxSize Capacity in entries.  Finite sizes are reserved up front.
+ */
+template<class K, class V, class Hash, class Mutex> HashLruCache<K,V,Hash,Mutex>::
+HashLruCache(size_t maxSize): m_maxSize(SIZE_MAX), m_hits(0), m_misses(0), m_clock(false)
+{
+#ifdef DEBUG_CACHE
+    std::ostringstream name;
+    name << "HashLruCache@" << this;
+    name_lock(m, name.str());
+#endif
+    set_max_size(maxSize);
+}
+
+/**
+ * @brief Destructor.  Calls empty_cache()
+ */
+template<class K, class V, class Hash, class Mutex> HashLruCache<K,V,Hash,Mutex>::
+~HashLruCache()
+{
+    stopAsyncCleanup();
+    empty_cache();
+}
+
+/**
+ * @brief Empties the cache.  The pool keeps its capacity.
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+empty_cache()
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_index.clear();
+    m_pool.clear();
+    m_free = NIL;
+    for (int segment = PROBATION; segment <= PROTECTED; segment++) {
+        m_head[segment] = m_tail[segment] = NIL;
+        m_segLength[segment] = m_segWeight[segment] = 0;
+    }
+    m_length = 0;
+    m_weight = 0;
+}
+
+/**
+ * @brief Sets the function that is called when something is booted from the cache
+ *
+ * If this function returns false when called, the object will not be booted from the cache!
+ *
+ * @param std::function handler the function
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+setCleanupHandler(std::function<bool(K,V)> handler)
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_cleanupHandler = handler;
+}
+
+/**
+ * @brief Runs the cleanup handler on background workers from now on
+ *
+ * @param numThreads Number of workers
+ * @param maxPending Evictions that may wait for a worker before inserting
+ *      threads run the handler themselves
+ *
+ * @return false if asynchronous cleanup is already running
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+startAsyncCleanup(unsigned numThreads, size_t maxPending)
+{
+    return m_cleanupJobs.start(numThreads, maxPending);
+}
+
+/**
+ * @brief Runs the cleanup handler on a running pool shared with other
+ *      caches, such as the other shards of a ShardedLruCache
+ *
+ * @param pool The workers.  stopAsyncCleanup() waits for this cache's
+ *      evictions but leaves them running.
+ *
+ * @return false if asynchronous cleanup is already running
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+startAsyncCleanup(std::shared_ptr<ThreadPool> pool)
+{
+    return m_cleanupJobs.start(pool);
+}
+
+/**
+ * @brief Waits for every pending eviction to be cleaned up, then goes back
+ *      to running the cleanup handler on the inserting thread
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+stopAsyncCleanup()
+{
+    m_cleanupJobs.stop();
+}
+
+/**
+ * @brief Returns the number of cached entries
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+size()
+{
+    read_lock lock(m);
+    return m_length;
+}
+
+/**
+ * @brief Sets the capacity and reserves room for that many entries.
+ *
+ * Entries over the new capacity are evicted by the next add_to_cache().
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+set_max_size(size_t maxSize)
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_maxSize = maxSize;
+    if (maxSize != SIZE_MAX && maxSize > m_pool.size()) {
+        m_pool.reserve(maxSize);
+        m_index.reserve(maxSize);
+    }
+    if (maxSize != SIZE_MAX && m_policy == EvictionPolicy::TINY_LFU) {
+        m_sketch.ensure_capacity(maxSize);
+    }
+}
+
+/**
+ * @brief Returns the capacity in entries
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+get_max_size()
+{
+    read_lock lock(m);
+    return m_maxSize;
+}
+
+/**
+ * @brief Sets the function that weighs entries against set_max_weight()
+ *
+ * Entries are weighed once, when added, so set this before filling the
+ * cache.  With no function every entry weighs 1.  The function is called
+ * with the cache locked, so it must not use the cache.
+ *
+ * @param weigher Returns the weight of a key and value, e.g. its size in bytes
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+setWeightFunction(std::function<size_t(const K&, const V&)> weigher)
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_weigher = weigher;
+}
+
+/**
+ * @brief Sets the capacity in weight.
+ *
+ * Entries over the new capacity are evicted by the next add_to_cache().
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+set_max_weight(size_t maxWeight)
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_maxWeight = maxWeight;
+}
+
+/**
+ * @brief Returns the capacity in weight
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+get_max_weight()
+{
+    read_lock lock(m);
+    return m_maxWeight;
+}
+
+/**
+ * @brief Lets single entries weigh more than the capacity in weight.
+ *
+ * An entry heavier than set_max_weight() but no heavier than this limit
+ * is still added: it evicts every other entry and stays, over capacity,
+ * until the next add_to_cache() evicts it in turn.  ShardedLruCache uses
+ * this so that an entry heavier than one shard's share of the capacity
+ * can still be cached.  0, the default, admits nothing heavier than the
+ * capacity in weight.
+ *
+ * @param maxEntryWeight Weight of the heaviest entry to admit
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+set_max_entry_weight(size_t maxEntryWeight)
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_maxEntryWeight = maxEntryWeight;
+}
+
+/**
+ * @brief Returns the total weight of the cached entries
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+get_weight()
+{
+    read_lock lock(m);
+    return m_weight;
+}
+
+/**
+ * @brief Returns the hit, miss and eviction counters and the current size
+ */
+template<class K, class V, class Hash, class Mutex> CacheStats HashLruCache<K,V,Hash,Mutex>::
+get_stats()
+{
+    read_lock lock(m);
+    CacheStats stats = m_stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.entries = m_length;
+    stats.weight = m_weight;
+    return stats;
+}
+
+/**
+ * @brief Zeroes the hit, miss and eviction counters
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+reset_stats()
+{
+    std::lock_guard<mutex_type> lock(m);
+    m_stats = CacheStats();
+    m_hits = 0;
+    m_misses = 0;
+}
+
+/**
+ * @brief Sets the eviction policy.  Cached entries are kept.
+ *
+ * @return false, leaving the policy unchanged, for TINY_LFU while CLOCK
+ *      recency is enabled
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+setEvictionPolicy(EvictionPolicy policy)
+{
+    std::lock_guard<mutex_type> lock(m);
+    if (policy == EvictionPolicy::TINY_LFU && m_clock) {
+        std::cerr << "HashLruCache::setEvictionPolicy ERROR: TINY_LFU does not support CLOCK recency" << std::endl;
+        return false;
+    }
+
+    m_policy = policy;
+    if (policy == EvictionPolicy::TINY_LFU) {
+        m_sketch.ensure_capacity(m_maxSize != SIZE_MAX ? m_maxSize : m_length);
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the eviction policy
+ */
+template<class K, class V, class Hash, class Mutex> EvictionPolicy HashLruCache<K,V,Hash,Mutex>::
+getEvictionPolicy()
+{
+    read_lock lock(m);
+    return m_policy;
+}
+
+/**
+ * @brief Chooses between exact LRU order, where every hit takes the lock
+ *      exclusively, and CLOCK reference bits, set under a shared lock.
+ *
+ * @return false, leaving recency unchanged, when enabling CLOCK under the
+ *      TINY_LFU policy or when Mutex is not acl::shared_mutex, since hits
+ *      would still take the lock exclusively
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+setClockRecency(bool enable)
+{
+    if (enable && !std::is_same<Mutex, acl::shared_mutex>::value) {
+        std::cerr << "HashLruCache::setClockRecency ERROR: CLOCK recency needs acl::shared_mutex as Mutex" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<mutex_type> lock(m);
+    if (enable && m_policy == EvictionPolicy::TINY_LFU) {
+        std::cerr << "HashLruCache::setClockRecency ERROR: TINY_LFU does not support CLOCK recency" << std::endl;
+        return false;
+    }
+
+    m_clock = enable;
+    return true;
+}
+
+/**
+ * @brief Returns true if hits set CLOCK reference bits
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+getClockRecency()
+{
+    return m_clock;
+}
+
+/**
+ * @brief Sets the name the cache's lock is listed under in the LockRegistry.
+ *        Does nothing unless built with DEBUG_CACHE.
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+set_lock_name(const std::string& name)
+{
+    name_lock(m, name);
+}
+
+/**
+ * @brief Retrieves the value pointed to by this key and marks it most recently used
+ *
+ * @param key The key
+ * @param[in] val The return value
+ *
+ * @return true on success.  False if no key exists or a cache miss
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+get_value(K key, V& val)
+{
+    if (m_clock.load(std::memory_order_relaxed)) {
+        read_lock lock(m);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        Node& node = m_pool[it->second];
+        val = node.value;
+        if (!node.referenced.bit.load(std::memory_order_relaxed)) {
+            node.referenced.bit.store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    std::lock_guard<mutex_type> lock(m);
+
+    if (m_policy == EvictionPolicy::TINY_LFU) {
+        m_sketch.increment(m_index.hash_function()(key));
+    }
+
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    size_t index = it->second;
+    val = m_pool[index].value;
+    touch(index);
+    return true;
+}
+
+/**
+ * @brief Retrieves the value pointed to by this key, calling loader to
+ *      produce and cache it on a miss.
+ *
+ * Concurrent callers that miss the same key share one call to a loader:
+ * the first caller's loader runs and the others wait for its result.  If
+ * the loader throws, every waiting caller gets the exception and nothing
+ * is cached.  If caching the loaded value throws (in the cleanup handler,
+ * say), only the caller that ran the loader gets that exception.  See
+ * TaskManager::performJob().
+ *
+ * @param key The key
+ * @param loader Produces the value of key
+ *
+ * @return The cached or loaded value
+ */
+template<class K, class V, class Hash, class Mutex> V HashLruCache<K,V,Hash,Mutex>::
+get_or_load(K key, std::function<V(void)> loader)
+{
+    V val;
+    if (get_value(key, val)) {
+        return val;
+    }
+
+    // Cache the value before retiring the load, so later callers find one or the other
+    return m_loads.performJob(key, loader,
+            [this, &key](V& cached) { return peek(key, cached); },
+            [this, &key](const V& loaded) { add_to_cache(key, loaded); });
+}
+
+/**
+ * @brief Adds a key and value as the most recently used entry, evicting the
+ *      least recently used entries if the cache is full.
+ *
+ * The cleanup handler runs without the lock held.  If it refuses an
+ * eviction, the entry is put back as most recently used; after 5 refusals
+ * the new entry is added over capacity.  If it throws, the entry is put
+ * back and the exception propagates without adding the new entry.
+ *
+ * @param key The key
+ * @param value The value
+ *
+ * @return false if the key is already cached, the entry alone weighs
+ *      more than the weight capacity (and set_max_entry_weight()), or the
+ *      TINY_LFU admission filter refused it
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+add_to_cache(K key, V value)
+{
+    std::unique_lock<mutex_type> lock(m);
+
+    if (m_index.count(key)) {
+        return false;
+    }
+
+    size_t weight = m_weigher ? m_weigher(key, value) : 1;
+    if (weight > m_maxWeight && weight > m_maxEntryWeight) {
+        return false;
+    }
+
+    // Only admit a new entry over the one it would evict if it is used more
+    if (m_policy == EvictionPolicy::TINY_LFU) {
+        uint64_t hash = m_index.hash_function()(key);
+        m_sketch.increment(hash);
+        if (m_length >= m_sketch.capacity()) {
+            m_sketch.ensure_capacity(2 * m_length);
+        }
+
+        size_t first = victim();
+        if (over_capacity(weight) && first != NIL &&
+            m_sketch.frequency(hash) <= m_sketch.frequency(m_index.hash_function()(m_pool[first].key))) {
+            m_stats.rejections++;
+            return false;
+        }
+    }
+
+    int count = 0;
+    size_t boot = NIL;
+    while (over_capacity(weight) && (boot = victim()) != NIL && count < 5) {  //Try to boot 5 times.  If still too big, give up.
+        unlink(boot);
+        m_index.erase(m_pool[boot].key);
+        K bootKey = std::move(m_pool[boot].key);
+        V bootValue = std::move(m_pool[boot].value);
+        size_t bootWeight = m_pool[boot].weight;
+        free_node(boot);
+
+        if (m_cleanupHandler) {
+            std::function<bool(K, V)> handler = m_cleanupHandler;
+
+            if (m_cleanupJobs.running()) {
+                std::shared_ptr<std::pair<K, V>> entry =
+                        std::make_shared<std::pair<K, V>>(std::move(bootKey), std::move(bootValue));
+                if (m_cleanupJobs.push_job(std::bind(&HashLruCache::cleanup, this, entry, bootWeight, handler))) {
+                    continue;
+                }
+
+                // The queue is full: clean up here and let the inserter wait
+                bootKey = std::move(entry->first);
+                bootValue = std::move(entry->second);
+            }
+
+            lock.unlock();
+            bool booted;
+            try {
+                booted = handler(bootKey, bootValue);
+            } catch (...) {
+                // Keep the entry rather than lose it with the handler's work undone
+                lock.lock();
+                restore(std::move(bootKey), std::move(bootValue), bootWeight);
+                throw;
+            }
+            lock.lock();
+
+            if (!booted) {
+                restore(std::move(bootKey), std::move(bootValue), bootWeight);
+                count++;
+                continue;
+            }
+        }
+        m_stats.evictions++;
+    }
+
+    // Another thread may have added the key while the handler ran
+    if (m_index.count(key)) {
+        return false;
+    }
+
+    size_t index = alloc_node(std::move(key), std::move(value), weight);
+    m_index.emplace(m_pool[index].key, index);
+    link_back(index, PROBATION);
+    return true;
+}
+
+/**
+ * @brief Takes a node from the free list, or appends one to the pool.
+ *
+ *      This function assumes the mutex has been locked before being called
+ *
+ * @return The index of the node, not yet linked
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+alloc_node(K&& key, V&& value, size_t weight)
+{
+    size_t index;
+    if (m_free != NIL) {
+        index = m_free;
+        m_free = m_pool[index].prev;
+        m_pool[index].key = std::move(key);
+        m_pool[index].value = std::move(value);
+        m_pool[index].weight = weight;
+        m_pool[index].referenced.bit = false;
+    } else {
+        index = m_pool.size();
+        m_pool.push_back(Node{std::move(key), std::move(value), weight, PROBATION, NIL, NIL, RefBit()});
+    }
+    m_length++;
+    m_weight += weight;
+    return index;
+}
+
+/**
+ * @brief Returns an unlinked node to the free list, releasing its value.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+free_node(size_t index)
+{
+    m_pool[index].value = V();
+    m_pool[index].next = NIL;
+    m_pool[index].prev = m_free;
+    m_free = index;
+    m_length--;
+    m_weight -= m_pool[index].weight;
+}
+
+/**
+ * @brief Links a node in as the most recently used of a segment.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+link_back(size_t index, int segment)
+{
+    Node& node = m_pool[index];
+    node.segment = segment;
+    node.prev = m_tail[segment];
+    node.next = NIL;
+    if (m_tail[segment] != NIL) {
+        m_pool[m_tail[segment]].next = index;
+    } else {
+        m_head[segment] = index;
+    }
+    m_tail[segment] = index;
+    m_segLength[segment]++;
+    m_segWeight[segment] += node.weight;
+}
+
+/**
+ * @brief Removes a node from its segment.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+unlink(size_t index)
+{
+    Node& node = m_pool[index];
+    if (node.prev != NIL) {
+        m_pool[node.prev].next = node.next;
+    } else {
+        m_head[node.segment] = node.next;
+    }
+    if (node.next != NIL) {
+        m_pool[node.next].prev = node.prev;
+    } else {
+        m_tail[node.segment] = node.prev;
+    }
+    node.prev = node.next = NIL;
+    m_segLength[node.segment]--;
+    m_segWeight[node.segment] -= node.weight;
+}
+
+/**
+ * @brief Moves a node that was hit to the back of its segment.  Under SLRU
+ *      and TINY_LFU a probationary node is promoted instead, demoting the
+ *      protected segment's least recently used nodes if it overflows.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+touch(size_t index)
+{
+    int segment = m_pool[index].segment;
+    if (m_policy == EvictionPolicy::LRU || segment == PROTECTED) {
+        if (index != m_tail[segment]) {
+            unlink(index);
+            link_back(index, segment);
+        }
+        return;
+    }
+
+    unlink(index);
+    link_back(index, PROTECTED);
+    while (protected_full() && m_head[PROTECTED] != index) {
+        size_t demoted = m_head[PROTECTED];
+        unlink(demoted);
+        link_back(demoted, PROBATION);
+    }
+}
+
+/**
+ * @brief Returns the node to evict next: the least recently used
+ *      probationary node, or protected node if there are none.  With CLOCK
+ *      recency, referenced nodes found there are cleared and touched first.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> size_t HashLruCache<K,V,Hash,Mutex>::
+victim()
+{
+    while (true) {
+        size_t index = m_head[PROBATION] != NIL ? m_head[PROBATION] : m_head[PROTECTED];
+        if (index == NIL || !m_clock || !m_pool[index].referenced.bit) {
+            return index;
+        }
+
+        // Every pass clears a bit, so this ends once all have been seen
+        m_pool[index].referenced.bit = false;
+        touch(index);
+    }
+}
+
+/**
+ * @brief Returns true if an entry of the given weight does not fit without evicting.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+over_capacity(size_t incoming) const
+{
+    return m_length >= m_maxSize || m_weight > m_maxWeight ||
+           incoming > m_maxWeight - m_weight;
+}
+
+/**
+ * @brief Returns true if the protected segment holds more than 80% of
+ *      either capacity.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+protected_full() const
+{
+    return (m_maxSize != SIZE_MAX && m_segLength[PROTECTED] > m_maxSize - m_maxSize / 5) ||
+           (m_maxWeight != SIZE_MAX && m_segWeight[PROTECTED] > m_maxWeight - m_maxWeight / 5);
+}
+
+/**
+ * @brief Reads the value of a cached key without counting a hit or a miss
+ *      and without changing its recency
+ *
+ * @return false if the key is not cached
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+peek(const K& key, V& val)
+{
+    read_lock lock(m);
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        return false;
+    }
+    val = m_pool[it->second].value;
+    return true;
+}
+
+/**
+ * @brief Puts back an entry whose cleanup handler refused its eviction, as
+ *      the most recently used probationary entry.
+ *
+ *      This function assumes the mutex has been locked before being called
+ *
+ * @return false if the key was cached again in the meantime
+ */
+template<class K, class V, class Hash, class Mutex> bool HashLruCache<K,V,Hash,Mutex>::
+restore(K&& key, V&& value, size_t weight)
+{
+    if (m_index.count(key)) {
+        std::cerr << "HashLruCache::add_to_cache ERROR: couldn't resubmit after failed boot" << std::endl;
+        return false;
+    }
+
+    size_t index = alloc_node(std::move(key), std::move(value), weight);
+    m_index.emplace(m_pool[index].key, index);
+    link_back(index, PROBATION);
+    return true;
+}
+
+/**
+ * @brief Runs the cleanup handler for an evicted entry on a background
+ *      worker, putting the entry back if the handler refuses or throws.
+ */
+template<class K, class V, class Hash, class Mutex> void HashLruCache<K,V,Hash,Mutex>::
+cleanup(std::shared_ptr<std::pair<K, V>> entry, size_t weight, std::function<bool(K, V)> handler)
+{
+    // No caller on the worker to take an exception
+    bool booted = false;
+    try {
+        booted = handler(entry->first, entry->second);
+    } catch (...) {
+        std::cerr << "HashLruCache::cleanup ERROR: cleanup handler threw, keeping the entry" << std::endl;
+    }
+
+    std::lock_guard<mutex_type> lock(m);
+    if (booted) {
+        m_stats.evictions++;
+    } else {
+        restore(std::move(entry->first), std::move(entry->second), weight);
+    }
+}
+}
@@ -9,15 +9,28 @@
 
 #pragma once
 
+#include "CacheStats.h"
 #include "TSQueue.tcc"
+#include "Thread.h"
+#include "JobGroup.h"
+#include "TaskManager.tcc"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <fstream>
 #include <assert.h>
 #include <random>
 #include "Timer.h"
 #include <mutex>
 #include <future>
+#include <cstdio>
 #include <ctime>
+#include <vector>
 
 namespace acl
 {
@@ -31,11 +44,109 @@ template<class K, class V> struct CacheNode {
     //TODO: Try to add this to the LruCache class.  Probably won't work due to inheritance
     K key;
     V value;
+    std::chrono::steady_clock::time_point expires = std::chrono::steady_clock::time_point::max();
+    size_t weight = 1;
+};
+
+/**
+ * @brief Reads and writes keys in LruCache snapshots.  Trivially copyable
+ *      types are written as raw bytes; specialize this for other key types.
+ */
+template<class T> struct SnapshotCodec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SnapshotCodec needs a specialization for this key type");
+
+    static bool write(std::ostream& out, const T& data)
+    {
+        return (bool)out.write(reinterpret_cast<const char*>(&data), sizeof(T));
+    }
+
+    static bool read(std::istream& in, T& data)
+    {
+        return (bool)in.read(reinterpret_cast<char*>(&data), sizeof(T));
+    }
+};
+
+/**
+ * @brief Writes strings as a length and their characters
+ */
+template<> struct SnapshotCodec<std::string> {
+    static bool write(std::ostream& out, const std::string& data)
+    {
+        uint64_t length = data.size();
+        return SnapshotCodec<uint64_t>::write(out, length) && out.write(data.data(), length);
+    }
+
+    static bool read(std::istream& in, std::string& data)
+    {
+        uint64_t length;
+        if (!SnapshotCodec<uint64_t>::read(in, length)) {
+            return false;
+        }
+
+        // Grow with the bytes actually read, so a corrupt length fails at
+        // the end of the stream instead of allocating it up front
+        char chunk[4096];
+        data.clear();
+        while (length > 0) {
+            std::streamsize n = (std::streamsize)std::min<uint64_t>(length, sizeof(chunk));
+            if (!in.read(chunk, n)) {
+                return false;
+            }
+            data.append(chunk, (size_t)n);
+            length -= n;
+        }
+        return true;
+    }
 };
 
 /**
  * @brief A thread-safe LRU Cache implementaiton.
  *
+ * The cleanup handler is called on the inserting thread unless
+ * startAsyncCleanup() hands evictions to background workers through a
+ * bounded queue.  When that queue is full the inserting thread calls the
+ * handler itself, so producers slow down to the rate the handler sustains.
+ * A handler that refuses or throws keeps its entry in the cache.  A throw
+ * on a worker is logged; on the inserting thread it propagates from
+ * add_to_cache() without adding the new entry.
+ *
+ * get_or_load() fills misses through a loader function, calling it once for
+ * all concurrent callers that miss the same key.
+ *
+ * Entries can be given a time to live, per entry or through
+ * set_default_ttl(), measured on the monotonic clock.  get_value() and
+ * get_lower_bound() treat an expired entry as a miss and drop it.
+ * Otherwise expired entries stay until they are evicted, unless
+ * startSweeper() runs a thread that reclaims them.
+ * The sweeper files entries in a hashed timer wheel by expiry time, so each
+ * tick only visits the entries due in that tick's slot, not the whole cache.
+ * Expired entries are dropped without calling the cleanup handler.
+ *
+ * Keys are kept in order, so get_lower_bound() and get_range() can find
+ * entries by key position, e.g. the frames cached between two timestamps.
+ *
+ * Capacity is an entry count (set_max_size) and, optionally, a total weight
+ * (set_max_weight) measured by a weight function such as the size of the
+ * value in bytes.  Entries are evicted until both limits are met, and
+ * get_stats() reports hits, misses, evictions and the current weight.
+ * With TTLs and snapshots as well, this is the cache for values of very
+ * different sizes such as image tiles; HashLruCache and ShardedLruCache
+ * trade those features for cheaper and more concurrent lookups.
+ *
+ * Every hit here moves its entry to the back of the queue under the
+ * queue's exclusive lock, so concurrent readers serialize.  Caches read
+ * from many threads at once should use HashLruCache or ShardedLruCache
+ * with acl::shared_mutex and setClockRecency(true), where a hit only sets
+ * a reference bit under a shared lock.
+ *
+ * save_snapshot() writes the keys from least to most recently used, with
+ * their remaining time to live and optionally their values, so that
+ * load_snapshot() can warm a new cache to the same contents and order after
+ * a restart.  The snapshot records when it was saved on the system clock,
+ * and loading takes the time since then off every time to live.  Keys are
+ * written with SnapshotCodec<K>.
+ *
  * @tparam K The key class used to access elements
  * @tparam V The cached object type
  */
@@ -47,27 +158,95 @@ private:
 public:
     virtual ~LruCache();
     virtual bool add_to_cache(K, V);
+    virtual bool add_to_cache(K, V, std::chrono::milliseconds ttl);
     virtual bool get_value(K, V&);
+    virtual V get_or_load(K key, std::function<V(void)> loader);
     virtual bool get_lower_bound(K, V&);
+    virtual std::vector<std::pair<K, V>> get_range(K first, K last, bool updateRecency = true);
+    bool save_snapshot(std::ostream& out, std::function<bool(std::ostream&, const V&)> encode = nullptr);
+    bool save_snapshot(const std::string& path, std::function<bool(std::ostream&, const V&)> encode = nullptr);
+    size_t load_snapshot(std::istream& in, std::function<bool(std::istream&, V&)> decode = nullptr,
+                         std::function<bool(const K&, V&)> fetch = nullptr);
+    size_t load_snapshot(const std::string& path, std::function<bool(std::istream&, V&)> decode = nullptr,
+                         std::function<bool(const K&, V&)> fetch = nullptr);
     virtual void empty_cache();
     virtual void setCleanupHandler(std::function<bool(K, V)> handler=nullptr);
+    virtual bool startAsyncCleanup(unsigned numThreads = 1, size_t maxPending = 1024);
+    virtual void stopAsyncCleanup();
+    void setWeightFunction(std::function<size_t(const K&, const V&)> weigher=nullptr);
+    void set_max_weight(size_t);
+    size_t get_max_weight();
+    size_t get_weight();
+    CacheStats get_stats();
+    void reset_stats();
+    void set_default_ttl(std::chrono::milliseconds ttl);
+    std::chrono::milliseconds get_default_ttl() const;
+    bool startSweeper(std::chrono::milliseconds tick = std::chrono::milliseconds(1000), size_t slots = 256);
+    void stopSweeper();
     using Q::size;
     using Q::set_max_size;
     using Q::get_max_size;
 
 protected:
     typedef typename Q::QNode QNode;      //<! Defining QNode
+    typedef std::chrono::steady_clock Clock;
+    typedef std::pair<K, Clock::time_point> WheelEntry; //<! A key and the expiry it was filed under
+    static const uint64_t SNAPSHOT_MAGIC = 0x323055524c4c4341ULL; //<! "ACLLRU02" in little endian
+
+    /**
+     * @brief Thread that reclaims expired entries once per tick
+     */
+    class Sweeper: public Thread
+    {
+    public:
+        Sweeper(LruCache* cache, Clock::duration tick): m_cache(cache), m_tick(tick) {}
+        virtual ~Sweeper() { Stop(); Join(); }
+        virtual void Stop();
+
+    protected:
+        virtual void mainLoop();
+
+        LruCache* m_cache;                  //<! Cache to sweep
+        Clock::duration m_tick;             //<! Time between sweeps
+        std::mutex m_waitMutex;             //<! Guards the wait between sweeps
+        std::condition_variable m_waitCv;   //<! Cuts the wait short on Stop()
+    };
+
     virtual bool push_to_back(std::shared_ptr<QNode>);
+    void unlink(std::shared_ptr<QNode>);    //<! Removes a node from the queue
+    bool over_capacity(size_t incoming) const; //<! True if an entry of this weight does not fit
+    bool expire(std::shared_ptr<QNode>, Clock::time_point now); //<! Drops the node if it has expired
+    void file_expiry(const std::shared_ptr<QNode>&); //<! Adds a node to the timer wheel
+    size_t sweep();                         //<! Drops the entries due since the last sweep
+    void restore(std::shared_ptr<QNode>);   //<! Puts back a node whose eviction was refused
+    void cleanup(std::shared_ptr<QNode>, std::function<bool(K, V)>); //<! Runs the handler on a worker
+    bool peek(const K& key, V& val);        //<! Reads a value without changing its recency
     std::map<K, std::weak_ptr<QNode>> keyMap;         // map of Key to weak pointer to QNodes
     std::function<bool(K, V)> m_cleanupHandler;
+    JobGroup m_cleanupJobs;                           // runs the handler after startAsyncCleanup()
+    TaskManager<K, V> m_loads;                        // get_or_load() calls in flight
+    std::function<size_t(const K&, const V&)> m_weigher; // weighs new entries; each weighs 1 if unset
+    size_t m_weight = 0;                              // total weight of cached entries
+    size_t m_maxWeight = SIZE_MAX;                    // capacity in weight
+    CacheStats m_stats;                               // hit, miss and eviction counters
+    std::atomic<int64_t> m_defaultTtl{0};             // milliseconds to live for add_to_cache(K, V); 0 is forever
+    std::vector<std::vector<WheelEntry>> m_wheel;     // slots of entries by expiry tick; empty without a sweeper
+    Clock::duration m_tick{0};                        // time covered by one slot
+    int64_t m_lastTick = 0;                           // last tick swept
+    std::unique_ptr<Sweeper> m_sweeper;               // runs sweep() after startSweeper()
 };
 
+template<class K, class V> const uint64_t LruCache<K,V>::SNAPSHOT_MAGIC;
+
 /*
- * @brief Destructor.  Calls empty_cache()
+ * @brief Destructor.  Stops the sweeper, finishes pending cleanups, then
+ *      calls empty_cache()
  */
 template<class K, class V> LruCache<K,V>::
 ~LruCache()
 {
+    stopSweeper();
+    stopAsyncCleanup();
     empty_cache();
 }
 
@@ -77,9 +256,14 @@ template<class K, class V> LruCache<K,V>::
 template<class K, class V> void LruCache<K,V>::
 empty_cache()
 {
-    std::lock_guard<std::recursive_mutex> lock(Q::m);
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
     keyMap.clear();
-    Q::delete_all();   //Recursive mutex allows for multiple locks from the same thread
+    Q::clear_storage();
+    m_weight = 0;
+    for (auto& slot : m_wheel) {
+        slot.clear();
+    }
+    Q::dequeue_cv.notify_all();
 }
 
 /**
@@ -95,20 +279,201 @@ setCleanupHandler(std::function<bool(K,V)> handler)
     m_cleanupHandler = handler;
 }
 
+/**
+ * @brief Calls the cleanup handler on background workers from now on
+ *
+ * @param numThreads Number of workers
+ * @param maxPending Evictions that may wait for a worker before inserting
+ *      threads call the handler themselves
+ *
+ * @return false if asynchronous cleanup is already running
+ */
+template<class K, class V> bool LruCache<K,V>::
+startAsyncCleanup(unsigned numThreads, size_t maxPending)
+{
+    return m_cleanupJobs.start(numThreads, maxPending);
+}
+
+/**
+ * @brief Waits for every pending eviction to be cleaned up, then goes back
+ *      to calling the cleanup handler on the inserting thread
+ */
+template<class K, class V> void LruCache<K,V>::
+stopAsyncCleanup()
+{
+    m_cleanupJobs.stop();
+}
+
+/**
+ * @brief Sets the function that weighs entries against set_max_weight()
+ *
+ * Each entry is weighed once, when it is added, so changing the function
+ * only affects entries added from now on.
+ *
+ * @param weigher Returns the weight of a key and value, e.g. its size in bytes
+ */
+template<class K, class V> void LruCache<K,V>::
+setWeightFunction(std::function<size_t(const K&, const V&)> weigher)
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    m_weigher = weigher;
+}
+
+/**
+ * @brief Sets the capacity in weight.
+ *
+ * Entries over the new capacity are evicted by the next add_to_cache().
+ */
+template<class K, class V> void LruCache<K,V>::
+set_max_weight(size_t maxWeight)
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    m_maxWeight = maxWeight;
+}
+
+/**
+ * @brief Returns the capacity in weight
+ */
+template<class K, class V> size_t LruCache<K,V>::
+get_max_weight()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    return m_maxWeight;
+}
+
+/**
+ * @brief Returns the total weight of the cached entries
+ */
+template<class K, class V> size_t LruCache<K,V>::
+get_weight()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    return m_weight;
+}
+
+/**
+ * @brief Returns the hit, miss and eviction counters and the current size
+ */
+template<class K, class V> CacheStats LruCache<K,V>::
+get_stats()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    CacheStats stats = m_stats;
+    stats.entries = Q::length;
+    stats.weight = m_weight;
+    return stats;
+}
+
+/**
+ * @brief Zeroes the hit, miss and eviction counters
+ */
+template<class K, class V> void LruCache<K,V>::
+reset_stats()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    m_stats = CacheStats();
+}
+
+/**
+ * @brief Sets the time to live of entries added without one
+ *
+ * @param ttl Time to live; zero or less never expires.  Applies to entries
+ *      added from now on.
+ */
+template<class K, class V> void LruCache<K,V>::
+set_default_ttl(std::chrono::milliseconds ttl)
+{
+    m_defaultTtl = ttl.count();
+}
+
+/**
+ * @brief Returns the time to live of entries added without one
+ */
+template<class K, class V> std::chrono::milliseconds LruCache<K,V>::
+get_default_ttl() const
+{
+    return std::chrono::milliseconds(m_defaultTtl.load());
+}
+
+/**
+ * @brief Starts a thread that reclaims expired entries
+ *
+ * @param tick Time between sweeps, and the resolution of the timer wheel
+ * @param slots Number of wheel slots.  Entries expiring more than
+ *      slots * tick ahead wait in their slot for later turns of the wheel.
+ *
+ * @return false if the sweeper is already running or its thread did not
+ *      start
+ */
+template<class K, class V> bool LruCache<K,V>::
+startSweeper(std::chrono::milliseconds tick, size_t slots)
+{
+    if (tick.count() <= 0 || slots == 0) {
+        std::cerr << "LruCache::startSweeper ERROR: tick and slots must be positive" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    if (m_sweeper) {
+        return false;
+    }
+
+    m_tick = tick;
+    m_lastTick = Clock::now().time_since_epoch() / m_tick;
+    m_wheel.assign(slots, std::vector<WheelEntry>());
+
+    // File the entries that already have an expiry
+    for (auto node = Q::head; node; node = node->prev) {
+        file_expiry(node);
+    }
+    m_sweeper.reset(new Sweeper(this, m_tick));
+    if (!m_sweeper->Start()) {
+        std::cerr << "LruCache::startSweeper ERROR: couldn't start the sweeper thread" << std::endl;
+        m_sweeper.reset();
+        m_wheel.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stops the sweeper thread.  get_value() still drops expired entries.
+ */
+template<class K, class V> void LruCache<K,V>::
+stopSweeper()
+{
+    std::unique_ptr<Sweeper> sweeper;
+    {
+        std::lock_guard<typename Q::mutex_type> lock(Q::m);
+        sweeper = std::move(m_sweeper);
+    }
+    if (!sweeper) {
+        return;
+    }
+
+    // The sweeper takes the cache lock, so it has to be joined without it
+    sweeper->Stop();
+    sweeper->Join();
+
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    m_wheel.clear();
+}
+
 /**
  * @brief Retrieves the value pointed to by this key
  *
  * @param key The key
  * @param[in] val The return value
  *
- * @return true on success.  False if no key exists or a cache miss
+ * @return true on success.  False if no key exists, it expired or a cache miss
  */
 template<class K, class V> bool LruCache<K,V>::
 get_value(K key, V& val)
 {
-    std::lock_guard<std::recursive_mutex> lock(Q::m);
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
 
     if (!keyMap.count(key)) {
+        m_stats.misses++;
         return false;
     } else if (keyMap[key].expired()) {
         std::cerr << "WE SHOULDN'T SEE THIS OR WE HAVE A PROBLEM" << std::endl;
@@ -123,70 +488,380 @@ get_value(K key, V& val)
 
         keyMap.erase(key);
         //std::cout << " real len: " << i << std::endl;
+        m_stats.misses++;
         return false;
     }
 
     auto node = keyMap[key].lock();
+    if (expire(node, Clock::now())) {
+        m_stats.misses++;
+        return false;
+    }
+    m_stats.hits++;
     val = node->data.value;
     push_to_back(node);
     return true;
 }
 
 /**
- * @brief Retrieves the value pointed to by this key
+ * @brief Retrieves the value pointed to by this key, calling loader to
+ *      produce and cache it on a miss.
+ *
+ * Like TaskManager::performJob(), concurrent callers that miss the same key
+ * share one call to a loader and wait for its result.  If the loader
+ * throws, every waiting caller gets the exception and nothing is cached;
+ * if caching the loaded value throws, only the caller that ran the loader
+ * gets that exception.
+ *
+ * @param key The key
+ * @param loader Produces the value of key
+ *
+ * @return The cached or loaded value
+ */
+template<class K, class V> V LruCache<K,V>::
+get_or_load(K key, std::function<V(void)> loader)
+{
+    V val;
+    if (get_value(key, val)) {
+        return val;
+    }
+
+    // Cache the value before retiring the load, so later callers find one or the other
+    return m_loads.performJob(key, loader,
+            [this, &key](V& cached) { return peek(key, cached); },
+            [this, &key](const V& loaded) { add_to_cache(key, loaded); });
+}
+
+/**
+ * @brief Retrieves the value of the first key not less than this key
  *
  * @param key The key
  * @param[in] val The return value
  *
- * @return true on success.  False if no key exists or a cache miss
+ * @return true on success.  False if no key at or after key is cached
  */
 template<class K, class V> bool LruCache<K,V>::
 get_lower_bound(K key, V& val)
 {
-    std::lock_guard<std::recursive_mutex> lock(Q::m);
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    Clock::time_point now = Clock::now();
+
+    auto it = keyMap.lower_bound(key);
+    while (it != keyMap.end()) {
+        auto node = it->second.lock();
+        if (!node) {
+            std::cerr << "WE SHOULDN'T SEE THIS OR WE HAVE A PROBLEM" << std::endl;
+            std::cerr << "map size: " << keyMap.size() << " length: " << Q::length << std::endl;
+            keyMap.erase(it);
+            return false;
+        }
+
+        // Expired entries are dropped and the search moves on
+        if (node->data.expires <= now) {
+            unlink(node);
+            it = keyMap.erase(it);
+            continue;
+        }
 
-    if (keyMap.lower_bound(key) == keyMap.end()) {
+        val = node->data.value;
+        push_to_back(node);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Retrieves every entry whose key lies in [first, last], in key
+ *      order, in a single pass under the lock
+ *
+ * @param first The smallest key to return
+ * @param last The largest key to return
+ * @param updateRecency true marks every returned entry used, in key order.
+ *      false leaves the LRU order alone, so a scan does not push out
+ *      entries that are used more often.
+ *
+ * @return The (key, value) pairs found, empty if none
+ */
+template<class K, class V> std::vector<std::pair<K, V>> LruCache<K,V>::
+get_range(K first, K last, bool updateRecency)
+{
+    std::vector<std::pair<K, V>> entries;
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    Clock::time_point now = Clock::now();
+
+    auto it = keyMap.lower_bound(first);
+    while (it != keyMap.end() && !(last < it->first)) {
+        auto node = it->second.lock();
+        if (!node) {
+            std::cerr << "LruCache::get_range ERROR: keyMap entry without a node" << std::endl;
+            it = keyMap.erase(it);
+            continue;
+        }
+
+        if (node->data.expires <= now) {
+            unlink(node);
+            it = keyMap.erase(it);
+            continue;
+        }
+
+        entries.emplace_back(it->first, node->data.value);
+        if (updateRecency) {
+            push_to_back(node);
+        }
+        ++it;
+    }
+    return entries;
+}
+
+/**
+ * @brief Writes the cached keys from least to most recently used, with
+ *      their remaining time to live and, with an encoder, their values.
+ *
+ * Only the keys and expiries are copied under the lock.  Values are read
+ * and encoded one at a time as they are written, so the cache keeps
+ * serving while a large snapshot streams out.  An entry evicted before its
+ * value is reached is written without one.
+ *
+ * Layout: magic, milliseconds since the system clock's epoch when the
+ * snapshot was taken, entry count, then per entry the key, the
+ * milliseconds it had left to live (0 if none), a flag and, if set, the
+ * encoded value's length and bytes.
+ *
+ * @param out Stream to write to, opened in binary mode
+ * @param encode Writes a value; nullptr writes keys only
+ *
+ * @return false if the stream failed
+ */
+template<class K, class V> bool LruCache<K,V>::
+save_snapshot(std::ostream& out, std::function<bool(std::ostream&, const V&)> encode)
+{
+    std::vector<std::pair<K, int64_t>> keys;
+    int64_t savedAt;
+    {
+        std::lock_guard<typename Q::mutex_type> lock(Q::m);
+        Clock::time_point now = Clock::now();
+        savedAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        keys.reserve(Q::length);
+
+        for (auto node = Q::head; node; node = node->prev) {
+            int64_t ttl = 0;
+            if (node->data.expires != Clock::time_point::max()) {
+                if (node->data.expires <= now) {
+                    continue;
+                }
+                ttl = std::chrono::duration_cast<std::chrono::milliseconds>(node->data.expires - now).count();
+                ttl = std::max<int64_t>(ttl, 1);
+            }
+            keys.emplace_back(node->data.key, ttl);
+        }
+    }
+
+    uint64_t count = keys.size();
+    if (!SnapshotCodec<uint64_t>::write(out, SNAPSHOT_MAGIC) || !SnapshotCodec<int64_t>::write(out, savedAt)
+        || !SnapshotCodec<uint64_t>::write(out, count)) {
+        std::cerr << "LruCache::save_snapshot ERROR: couldn't write header" << std::endl;
         return false;
-    } else if (keyMap.lower_bound(key)->second.expired()) {
-        std::cerr << "WE SHOULDN'T SEE THIS OR WE HAVE A PROBLEM" << std::endl;
-        std::cerr << "map size: " << keyMap.size() << " length: " << Q::length;
-        auto node = Q::head;
-        int i = 0;
+    }
 
-        while (node) {
-            i++;
-            node = node->prev;
+    V value;
+    std::ostringstream encoded;
+    for (auto& entry : keys) {
+        uint8_t hasValue = encode && peek(entry.first, value);
+        if (hasValue) {
+            encoded.str("");
+            if (!encode(encoded, value)) {
+                std::cerr << "LruCache::save_snapshot ERROR: couldn't encode a value" << std::endl;
+                return false;
+            }
         }
 
-        keyMap.erase(key);
-        //std::cout << " real len: " << i << std::endl;
+        bool ok = SnapshotCodec<K>::write(out, entry.first) && SnapshotCodec<int64_t>::write(out, entry.second)
+                  && SnapshotCodec<uint8_t>::write(out, hasValue);
+        if (ok && hasValue) {
+            std::string bytes = encoded.str();
+            ok = SnapshotCodec<std::string>::write(out, bytes);
+        }
+        if (!ok) {
+            std::cerr << "LruCache::save_snapshot ERROR: couldn't write an entry" << std::endl;
+            return false;
+        }
+    }
+    return (bool)out.flush();
+}
+
+/**
+ * @brief Writes a snapshot to a file.  See save_snapshot(std::ostream&).
+ *
+ * The snapshot is written to path + ".tmp" and renamed over path once
+ * complete, so a crash while saving leaves the previous snapshot intact.
+ */
+template<class K, class V> bool LruCache<K,V>::
+save_snapshot(const std::string& path, std::function<bool(std::ostream&, const V&)> encode)
+{
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "LruCache::save_snapshot ERROR: couldn't open " << tmpPath << std::endl;
         return false;
     }
 
-    auto node = keyMap.lower_bound(key)->second.lock();
-    val = node->data.value;
-    push_to_back(node);
+    bool saved = save_snapshot(out, std::move(encode));
+    out.close();
+    if (!saved || out.fail()) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "LruCache::save_snapshot ERROR: couldn't replace " << path << std::endl;
+        std::remove(tmpPath.c_str());
+        return false;
+    }
     return true;
 }
 
+/**
+ * @brief Adds the entries of a snapshot, oldest first, so they keep the
+ *      recency order they were saved in.
+ *
+ * Entries are read and added one at a time.  When the snapshot holds more
+ * entries than the cache does, the least recently used ones are skipped
+ * rather than loaded and evicted.  Keys already cached are left alone.
+ * The time since the snapshot was saved, by the system clock, is taken off
+ * each entry's time to live, and entries that have expired meanwhile are
+ * skipped.
+ *
+ * @param in Stream written by save_snapshot(), opened in binary mode
+ * @param decode Reads a value saved with an encoder
+ * @param fetch Produces the value of a key saved without one, e.g. from the
+ *      backing store; returning false skips the key.  Keys without a value
+ *      are skipped if this is nullptr.
+ *
+ * @return The number of entries added
+ */
+template<class K, class V> size_t LruCache<K,V>::
+load_snapshot(std::istream& in, std::function<bool(std::istream&, V&)> decode,
+              std::function<bool(const K&, V&)> fetch)
+{
+    uint64_t magic;
+    int64_t savedAt;
+    uint64_t count;
+    if (!SnapshotCodec<uint64_t>::read(in, magic) || magic != SNAPSHOT_MAGIC
+        || !SnapshotCodec<int64_t>::read(in, savedAt) || !SnapshotCodec<uint64_t>::read(in, count)) {
+        std::cerr << "LruCache::load_snapshot ERROR: not a cache snapshot" << std::endl;
+        return 0;
+    }
+
+    // A clock set back since the save counts as no time passed
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - savedAt;
+    elapsed = std::max<int64_t>(elapsed, 0);
+
+    uint64_t skip = count > get_max_size() ? count - get_max_size() : 0;
+    size_t added = 0;
+    K key;
+    V value;
+    std::string bytes;
+
+    for (uint64_t i = 0; i < count; i++) {
+        int64_t ttl;
+        uint8_t hasValue;
+        if (!SnapshotCodec<K>::read(in, key) || !SnapshotCodec<int64_t>::read(in, ttl)
+            || !SnapshotCodec<uint8_t>::read(in, hasValue)
+            || (hasValue && !SnapshotCodec<std::string>::read(in, bytes))) {
+            std::cerr << "LruCache::load_snapshot ERROR: snapshot truncated after "
+                      << i << " of " << count << " entries" << std::endl;
+            break;
+        }
+
+        if (i < skip) {
+            continue;
+        }
+        if (ttl > 0) {
+            ttl -= elapsed;
+            if (ttl <= 0) {
+                continue;
+            }
+        }
+
+        bool found;
+        if (hasValue && decode) {
+            std::istringstream encoded(bytes);
+            found = decode(encoded, value);
+        } else {
+            found = fetch && fetch(key, value);
+        }
+
+        if (found && add_to_cache(key, value, std::chrono::milliseconds(ttl))) {
+            added++;
+        }
+    }
+    return added;
+}
+
+/**
+ * @brief Loads a snapshot from a file.  See load_snapshot(std::istream&).
+ */
+template<class K, class V> size_t LruCache<K,V>::
+load_snapshot(const std::string& path, std::function<bool(std::istream&, V&)> decode,
+              std::function<bool(const K&, V&)> fetch)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "LruCache::load_snapshot ERROR: couldn't open " << path << std::endl;
+        return 0;
+    }
+    return load_snapshot(in, std::move(decode), std::move(fetch));
+}
+
 /**
  * @brief This function creates a CacheNode which contains a key and a value,
- *      then adds it to the queue.
+ *      then adds it to the queue.  The entry lives for the default time to
+ *      live.
  *
  * @param key The key
  * @param value The value
- * @param force true will push data even if the length is greater than max_size
  *
- * @return
+ * @return false if the key is already cached
  */
 template<class K, class V> bool LruCache<K,V>::
 add_to_cache(K key, V value)
 {
-    std::unique_lock<std::recursive_mutex> lock(Q::m);
+    return add_to_cache(std::move(key), std::move(value), get_default_ttl());
+}
+
+/**
+ * @brief This function creates a CacheNode which contains a key and a value,
+ *      then adds it to the queue.
+ *
+ * @param key The key
+ * @param value The value
+ * @param ttl Time to live; zero or less never expires
+ *
+ * @return false if the key is already cached or the entry alone weighs
+ *      more than the weight capacity
+ */
+template<class K, class V> bool LruCache<K,V>::
+add_to_cache(K key, V value, std::chrono::milliseconds ttl)
+{
+    std::unique_lock<typename Q::mutex_type> lock(Q::m);
+    Clock::time_point now = Clock::now();
+
+    // Don't boot anything for a key that is going to be refused.  An
+    // expired entry is replaced.
+    auto existing = keyMap.find(key);
+    if (existing != keyMap.end() && !expire(existing->second.lock(), now)) {
+        return false;
+    }
+
+    size_t weight = m_weigher ? m_weigher(key, value) : 1;
+    if (weight > m_maxWeight) {
+        return false;
+    }
 
     //Check to see if something needs booted
     int count = 0;
-    while (Q::length >= Q::max_size && count < 5) {  //Try to boot 5 times.  If still too big, give up.
+    while (over_capacity(weight) && count < 5) {  //Try to boot 5 times.  If still too big, give up.
         if (!Q::head) {
             std::cerr << "LruCache::add_to_cache ERROR: Head is null but length is non-zero." << std::endl;
             break;
@@ -201,6 +876,7 @@ add_to_cache(K key, V value)
         }
 
         Q::length--;
+        m_weight -= temp->data.weight;
         if (keyMap.erase(temp->data.key) == 0) {
             std::cerr << "LruCache::add_to_cache ERROR: keyMap could not find key" 
                       << std::endl;
@@ -217,30 +893,44 @@ add_to_cache(K key, V value)
             //std::cout << "actual length: " << i << std::endl;
         }
 
-        if (m_cleanupHandler) {
+        // Expired entries go without the cleanup handler
+        if (m_cleanupHandler && temp->data.expires > now) {
+            // When the queue is full, clean up here and let the inserter wait
+            if (m_cleanupJobs.running() && m_cleanupJobs.push_job(
+                    std::bind(&LruCache::cleanup, this, temp, m_cleanupHandler))) {
+                continue;
+            }
+
+            std::function<bool(K, V)> handler = m_cleanupHandler;
             lock.unlock();
-            bool boot = m_cleanupHandler(temp->data.key, temp->data.value);
+            bool boot;
+            try {
+                boot = handler(temp->data.key, temp->data.value);
+            } catch (...) {
+                // Keep the entry rather than lose it with the handler's work undone
+                lock.lock();
+                restore(temp);
+                throw;
+            }
             lock.lock();
 
             if (!boot) {
-                auto it = keyMap.emplace(temp->data.key, temp);
-
-                if (it.second) {
-                    Q::enqueue(temp);
-                } else {
-                    std::cerr << "LruCache::add_to_cache ERROR: couldn't resubmit after failed boot" << std::endl;
-                }
-
+                restore(temp);
                 count++;
                 continue;
             }
         }
+        m_stats.evictions++;
     }
 
     // Create a CacheNode to put in the queue
     CacheNode<K,V> node;
     node.key = key;
     node.value = value;
+    node.weight = weight;
+    if (ttl.count() > 0) {
+        node.expires = now + ttl;
+    }
 
     // Create a QNode pointer out of that CacheNode
     std::shared_ptr<QNode> temp = std::shared_ptr<QNode>(new QNode(node));
@@ -255,7 +945,9 @@ add_to_cache(K key, V value)
     }
 
     // Enqueue the CacheNode and notify of a new object in the queue
-    Q::enqueue(temp); //Recursive mutex allows for multiple locks from the same thread
+    Q::enqueue(temp);
+    m_weight += weight;
+    file_expiry(temp);
     Q::enqueue_cv.notify_one();
     return true;
 }
@@ -297,4 +989,230 @@ push_to_back(std::shared_ptr<QNode> node)
 
     return true;
 }
+
+/**
+ * @brief Reads the value of a cached key without changing its recency
+ *
+ * @return false if the key is not cached
+ */
+template<class K, class V> bool LruCache<K,V>::
+peek(const K& key, V& val)
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    auto it = keyMap.find(key);
+    if (it == keyMap.end()) {
+        return false;
+    }
+
+    auto node = it->second.lock();
+    if (!node || node->data.expires <= Clock::now()) {
+        return false;
+    }
+    val = node->data.value;
+    return true;
+}
+
+/**
+ * @brief Puts back a node whose cleanup handler refused its eviction, as
+ *      the most recently used entry.
+ *
+ *      This function assumes the mutex has been locked before being called
+ *
+ * @param node The evicted node
+ */
+template<class K, class V> void LruCache<K,V>::
+restore(std::shared_ptr<QNode> node)
+{
+    auto it = keyMap.emplace(node->data.key, node);
+
+    if (it.second) {
+        Q::enqueue(node);
+        m_weight += node->data.weight;
+
+        // A sweep while the node was out dropped its wheel entry
+        file_expiry(node);
+    } else {
+        std::cerr << "LruCache::add_to_cache ERROR: couldn't resubmit after failed boot" << std::endl;
+    }
+}
+
+/**
+ * @brief Calls the cleanup handler for an evicted node on a background
+ *      worker, putting the node back if the handler refuses or throws.
+ */
+template<class K, class V> void LruCache<K,V>::
+cleanup(std::shared_ptr<QNode> node, std::function<bool(K, V)> handler)
+{
+    // No caller on the worker to take an exception
+    bool booted = false;
+    try {
+        booted = handler(node->data.key, node->data.value);
+    } catch (...) {
+        std::cerr << "LruCache::cleanup ERROR: cleanup handler threw, keeping the entry" << std::endl;
+    }
+
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    if (booted) {
+        m_stats.evictions++;
+    } else {
+        restore(node);
+    }
+}
+
+/**
+ * @brief Removes a node from anywhere in the queue.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V> void LruCache<K,V>::
+unlink(std::shared_ptr<QNode> node)
+{
+    auto older = node->next.lock();
+    auto newer = node->prev;
+
+    if (older) {
+        older->prev = newer;
+    } else {
+        Q::head = newer;
+    }
+
+    if (newer) {
+        newer->next = older;
+    } else {
+        Q::tail = older;
+    }
+
+    node->prev = nullptr;
+    node->next.reset();
+    Q::length--;
+    m_weight -= node->data.weight;
+}
+
+/**
+ * @brief Returns true if an entry of the given weight does not fit without evicting.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V> bool LruCache<K,V>::
+over_capacity(size_t incoming) const
+{
+    return Q::length >= Q::max_size || m_weight > m_maxWeight ||
+           incoming > m_maxWeight - m_weight;
+}
+
+/**
+ * @brief Drops a node from the cache if it has expired.
+ *
+ *      This function assumes the mutex has been locked before being called
+ *
+ * @return true if the node expired
+ */
+template<class K, class V> bool LruCache<K,V>::
+expire(std::shared_ptr<QNode> node, Clock::time_point now)
+{
+    if (!node || node->data.expires > now) {
+        return false;
+    }
+
+    keyMap.erase(node->data.key);
+    unlink(node);
+    return true;
+}
+
+/**
+ * @brief Files a node with an expiry in the timer wheel slot of the first
+ *      tick at or after its expiry.  Does nothing without a sweeper.
+ *
+ *      This function assumes the mutex has been locked before being called
+ */
+template<class K, class V> void LruCache<K,V>::
+file_expiry(const std::shared_ptr<QNode>& node)
+{
+    Clock::time_point expires = node->data.expires;
+    if (m_wheel.empty() || expires == Clock::time_point::max()) {
+        return;
+    }
+
+    int64_t tick = (expires.time_since_epoch() + m_tick - Clock::duration(1)) / m_tick;
+    tick = std::max(tick, m_lastTick + 1);
+    m_wheel[tick % m_wheel.size()].emplace_back(node->data.key, expires);
+}
+
+/**
+ * @brief Drops the entries that expired in the ticks since the last sweep,
+ *      visiting only their wheel slots
+ *
+ * @return The number of entries dropped
+ */
+template<class K, class V> size_t LruCache<K,V>::
+sweep()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    if (m_wheel.empty()) {
+        return 0;
+    }
+
+    Clock::time_point now = Clock::now();
+    int64_t tick = now.time_since_epoch() / m_tick;
+    if (tick <= m_lastTick) {
+        return 0;
+    }
+
+    // Past a full turn every slot is due
+    int64_t first = std::max(m_lastTick + 1, tick - (int64_t)m_wheel.size() + 1);
+    size_t dropped = 0;
+
+    for (int64_t t = first; t <= tick; t++) {
+        std::vector<WheelEntry>& slot = m_wheel[t % m_wheel.size()];
+        size_t kept = 0;
+
+        for (size_t i = 0; i < slot.size(); i++) {
+            auto it = keyMap.find(slot[i].first);
+            if (it == keyMap.end()) {
+                continue;   // Evicted or already expired
+            }
+
+            auto node = it->second.lock();
+            if (!node || node->data.expires != slot[i].second) {
+                continue;   // Replaced by a newer entry, filed on its own
+            }
+
+            if (expire(node, now)) {
+                dropped++;
+            } else {
+                slot[kept++] = std::move(slot[i]);   // Due on a later turn
+            }
+        }
+        slot.erase(slot.begin() + kept, slot.end());
+    }
+
+    m_lastTick = tick;
+    return dropped;
+}
+
+/**
+ * @brief Stops the sweeper and wakes it if it is waiting for its next tick
+ */
+template<class K, class V> void LruCache<K,V>::Sweeper::
+Stop()
+{
+    std::lock_guard<std::mutex> lock(m_waitMutex);
+    Thread::Stop();
+    m_waitCv.notify_all();
+}
+
+/**
+ * @brief Waits one tick, then sweeps the cache
+ */
+template<class K, class V> void LruCache<K,V>::Sweeper::
+mainLoop()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        if (m_waitCv.wait_for(lock, m_tick, [this] { return !isRunning(); })) {
+            return;
+        }
+    }
+    m_cache->sweep();
+}
 }
@@ -0,0 +1,293 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file MPMCQueue.tcc
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <stdint.h>
+
+#ifndef ACL_CACHE_LINE_SIZE
+#define ACL_CACHE_LINE_SIZE 64
+#endif
+
+namespace acl
+{
+
+/**
+* @brief A bounded lock-free multi-producer/multi-consumer queue
+*
+* Array of cells tagged with sequence numbers (D. Vyukov's bounded MPMC
+* queue).  enqueue() and try_dequeue() only contend on a single CAS of the
+* enqueue or dequeue position and never take a lock.
+*
+* Blocking dequeue() spins briefly, then parks on a condition variable.
+* Producers only touch the mutex when a consumer is parked, so idle workers
+* neither burn cores nor slow down the fast path.
+*
+* @tparam T The type of data to be contained in the queue.  Must be default
+*         constructible and assignable.
+*/
+template <typename T> class MPMCQueue
+{
+public:
+    MPMCQueue(size_t maxSize = 1024);                     //<! Constructor
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    bool enqueue(const T& data) { return store(data); }             //<! Copy data to the tail of the queue
+    bool enqueue(T&& data) { return store(std::move(data)); }       //<! Move data to the tail of the queue
+    bool try_dequeue(T& data);                            //<! Remove data from the head without blocking
+    bool dequeue(T& data, uint16_t timeout = 0);          //<! Remove data from the head, spinning then parking
+    size_t size() const;                                  //<! Return the (approximate) size of the queue
+    size_t get_max_size() const;                          //<! Returns max size
+    void delete_all();                                    //<! Drains and drops every element
+    bool wait_until_empty(uint16_t timeout = 0);          //<! Waits until queue is empty
+
+    static const int SPIN_COUNT = 64;                     //<! try_dequeue attempts before parking
+
+protected:
+    template<typename U> bool store(U&& data);            //<! Shared body of both enqueue overloads
+    bool take(T& data);                                   //<! try_dequeue without the empty notification
+
+    struct Cell {
+        std::atomic_size_t sequence;                      //<! Position this cell is ready for
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;                      //<! Ring storage
+    size_t m_mask;                                        //<! Cell count - 1 (cell count is a power of 2)
+    char m_pad0[ACL_CACHE_LINE_SIZE];
+    std::atomic_size_t m_enqueuePos;                      //<! Next position to enqueue
+    char m_pad1[ACL_CACHE_LINE_SIZE];
+    std::atomic_size_t m_dequeuePos;                      //<! Next position to dequeue
+    char m_pad2[ACL_CACHE_LINE_SIZE];
+
+    std::atomic_int m_sleepers;                           //<! Consumers parked in dequeue
+    std::atomic_int m_emptyWaiters;                       //<! Threads parked in wait_until_empty
+    std::mutex m_mutex;                                   //<! Only used for parking
+    std::condition_variable m_enqueueCv;                  //<! Wakes parked consumers
+    std::condition_variable m_emptyCv;                    //<! Wakes wait_until_empty
+};
+
+/**
+* @brief Constructor.  Preallocates the ring.
+*
+* @param maxSize The minimum number of elements the queue will hold.  This
+*        is rounded up to a power of two.
+**/
+template<typename T> MPMCQueue<T>::MPMCQueue(size_t maxSize)
+    : m_enqueuePos(0), m_dequeuePos(0), m_sleepers(0), m_emptyWaiters(0)
+{
+    size_t cells = 2;
+    while (cells < maxSize) {
+        cells <<= 1;
+    }
+
+    m_mask = cells - 1;
+    m_cells.reset(new Cell[cells]);
+
+    for (size_t i = 0; i < cells; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+/**
+* @brief Adds data to the tail of the queue
+*
+* @param data The data to add
+* @return false if the queue is full
+*/
+template<typename T>
+template<typename U> bool MPMCQueue<T>::store(U&& data)
+{
+    Cell* cell;
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        cell = &m_cells[pos & m_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->data = std::forward<U>(data);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in dequeue so a consumer about to park either
+    // sees this element or is seen as a sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_enqueueCv.notify_one();
+    }
+    return true;
+}
+
+/**
+* @brief Removes the head of the queue if there is one
+*
+* @param data Receives the head of the queue
+* @return false if the queue was empty
+*/
+template<typename T> bool MPMCQueue<T>::try_dequeue(T& data)
+{
+    if (!take(data)) {
+        return false;
+    }
+
+    // Pairs with the fence in wait_until_empty
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_emptyWaiters.load(std::memory_order_relaxed) && !size()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_emptyCv.notify_all();
+    }
+    return true;
+}
+
+/**
+* @brief Claims the head cell and moves its data out.  Safe to call with
+*        m_mutex held.
+*
+* @param data Receives the head of the queue
+* @return false if the queue was empty
+*/
+template<typename T> bool MPMCQueue<T>::take(T& data)
+{
+    Cell* cell;
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+        cell = &m_cells[pos & m_mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = m_dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    data = std::move(cell->data);
+    cell->data = T{};
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+* @brief Removes and returns the head of the queue.  Spins for a short
+*        while, then parks until data arrives or the timeout expires.
+*
+* @param data Receives the head of the queue
+* @param timeout How long to block before timeout in milliseconds.
+*
+* @return false if no data arrived before the timeout
+*/
+template<typename T> bool MPMCQueue<T>::dequeue(T& data, uint16_t timeout)
+{
+    for (int i = 0; i < SPIN_COUNT; i++) {
+        if (try_dequeue(data)) {
+            return true;
+        }
+        if (!timeout) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool rc = m_enqueueCv.wait_for(lock, std::chrono::milliseconds(timeout),
+            [this, &data] {return take(data);});
+
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rc && m_emptyWaiters.load(std::memory_order_relaxed) && !size()) {
+        m_emptyCv.notify_all();
+    }
+    return rc;
+}
+
+/**
+* @brief Returns the number of items in the queue.  This is only a snapshot
+*        while other threads are active.
+*/
+template<typename T> size_t MPMCQueue<T>::size() const
+{
+    size_t dequeuePos = m_dequeuePos.load(std::memory_order_acquire);
+    size_t enqueuePos = m_enqueuePos.load(std::memory_order_acquire);
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+/**
+* @brief Returns the number of elements the queue can hold
+*/
+template<typename T> size_t MPMCQueue<T>::get_max_size() const
+{
+    return m_mask + 1;
+}
+
+/**
+* @brief Dequeues and drops every element currently in the queue
+*/
+template<typename T> void MPMCQueue<T>::delete_all()
+{
+    T data;
+    while (try_dequeue(data)) {}
+}
+
+/**
+ * @brief Waits until the queue is empty, then returns.
+ * NOTE: Due to the uncertain nature of multithreaded programming,
+ * by the time this function returns, new objects may have been added
+ *
+ * @param timeout the maximum number of milliseconds to wait.
+ * NOTE: A timeout of 0 will wait indefinitely.
+ *
+ * @return true if queue got to 0, false if timeout occured
+ */
+template<typename T> bool MPMCQueue<T>::wait_until_empty(uint16_t timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_emptyWaiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool rc = true;
+    if (!timeout) {
+        m_emptyCv.wait(lock, [this] {return size() == 0;});
+    } else {
+        rc = m_emptyCv.wait_for(lock, std::chrono::milliseconds(timeout),
+                [this] {return size() == 0;});
+    }
+
+    m_emptyWaiters.fetch_sub(1, std::memory_order_relaxed);
+    return rc;
+}
+}
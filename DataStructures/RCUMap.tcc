@@ -0,0 +1,493 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file RCUMap.tcc
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef ACL_CACHE_LINE_SIZE
+#define ACL_CACHE_LINE_SIZE 64
+#endif
+
+namespace acl
+{
+
+    /*
+     * \brief Read-mostly ordered map using read-copy-update
+     *
+     * The map contents live in an immutable std::map that is published
+     * through an atomic pointer.  Readers never lock: they announce
+     * themselves in a per-thread counter slot, load the pointer and read
+     * the snapshot directly.  Writers serialize on a mutex, copy the current
+     * snapshot, modify the copy, publish it and then wait for a grace period
+     * (two epoch flips) before freeing the previous version.
+     *
+     * Every write copies the whole map, so this is only a good fit for
+     * tables that are updated rarely and read constantly.  Use update() to
+     * batch several changes into a single copy.
+     *
+     * A thread must not write to the map while it holds a Snapshot of the
+     * same map; the writer would wait for its own read section forever.
+     */
+    template<typename Key, typename Value, typename Compare = std::less<Key>> class RCUMap
+    {
+        public:
+            typedef std::map<Key, Value, Compare> MapType;
+
+        protected:
+            /*
+             * \brief Reader counters for one group of threads, one per epoch
+             *        parity, padded so groups do not share cache lines
+             */
+            struct ReaderSlot {
+                std::atomic_long    count[2];
+                char                pad[ACL_CACHE_LINE_SIZE];
+            };
+
+            std::atomic<const MapType*>     m_current;      //!< Published snapshot
+            std::atomic_uint                m_epoch;        //!< Low bit selects the counter new readers use
+            std::unique_ptr<ReaderSlot[]>   m_slots;        //!< Distributed reader counters
+            unsigned                        m_slotMask;     //!< Slot count - 1 (power of 2)
+            std::mutex                      m_writeMutex;   //!< Serializes writers
+
+            static unsigned thread_index();
+            unsigned read_lock(const MapType*& map) const;
+            void     read_unlock(unsigned token) const;
+            void     publish(MapType* next);
+            void     wait_for_readers(unsigned parity) const;
+
+        public:
+            /*
+             * \brief Lock-free read handle to the snapshot that was current
+             *        when it was taken.  The snapshot is never modified and
+             *        stays valid until the handle is released or destroyed.
+             */
+            class Snapshot
+            {
+                public:
+                    Snapshot() : m_owner(nullptr), m_map(nullptr), m_token(0) {}
+                    Snapshot(const Snapshot&) = delete;
+                    Snapshot& operator=(const Snapshot&) = delete;
+                    Snapshot(Snapshot&& other) : m_owner(other.m_owner), m_map(other.m_map), m_token(other.m_token)
+                    {
+                        other.m_owner = nullptr;
+                        other.m_map = nullptr;
+                    }
+                    Snapshot& operator=(Snapshot&& other)
+                    {
+                        if (this != &other) {
+                            release();
+                            std::swap(m_owner, other.m_owner);
+                            std::swap(m_map, other.m_map);
+                            std::swap(m_token, other.m_token);
+                        }
+                        return *this;
+                    }
+                    ~Snapshot() { release(); }
+
+                    const MapType& operator*() const { return *m_map; }
+                    const MapType* operator->() const { return m_map; }
+
+                    /*
+                     * \brief Ends the read section early. The handle is empty afterwards
+                     */
+                    void release()
+                    {
+                        if (m_owner) {
+                            m_owner->read_unlock(m_token);
+                        }
+                        m_owner = nullptr;
+                        m_map = nullptr;
+                    }
+
+                private:
+                    friend class RCUMap;
+                    Snapshot(const RCUMap* owner) : m_owner(owner)
+                    {
+                        m_token = owner->read_lock(m_map);
+                    }
+
+                    const RCUMap*   m_owner;    //!< Map whose read section is held
+                    const MapType*  m_map;      //!< Snapshot being read
+                    unsigned        m_token;    //!< Reader slot and parity to release
+            };
+
+            RCUMap(const Compare& comp = Compare());
+            virtual ~RCUMap();
+            RCUMap(const RCUMap&) = delete;
+            RCUMap& operator=(const RCUMap&) = delete;
+
+            // read functions, never block
+            Snapshot                snapshot() const;
+            std::pair<Value, bool>  find(const Key& k) const;
+            std::pair<Value, bool>  lower_bound(const Key& k) const;
+            template<typename F>
+            bool                    visit(const Key& k, F f) const;
+            size_t                  size() const;
+            bool                    empty() const;
+            std::vector<Key>        getKeyList() const;
+            size_t                  for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const;
+
+            // write functions, each copies the map once
+            bool                    emplace(const Key& k, Value v, bool force = false);
+            std::pair<Value,bool>   replace(const Key& k, Value v, bool force = true);
+            bool                    erase(const Key& k);
+            std::pair<Value, bool>  remove(const Key& k);
+            void                    update(std::function<void(MapType& m)> f);
+            void                    clear();
+    };
+
+    /**
+     * \brief Constructor
+     * \param comp The comparison object used to order keys
+     **/
+    template<typename Key, typename Value, typename Compare> RCUMap<Key, Value, Compare>::
+            RCUMap(const Compare& comp)
+        : m_current(new MapType(comp)), m_epoch(0)
+    {
+        unsigned threads = std::thread::hardware_concurrency();
+        unsigned slots = 8;
+        while (slots < threads) {
+            slots <<= 1;
+        }
+
+        m_slotMask = slots - 1;
+        m_slots.reset(new ReaderSlot[slots]);
+        for (unsigned i = 0; i < slots; i++) {
+            m_slots[i].count[0] = 0;
+            m_slots[i].count[1] = 0;
+        }
+    }
+
+    /**
+     * \brief Destructor.  No readers may be active.
+     */
+    template<typename Key, typename Value, typename Compare> RCUMap<Key, Value, Compare>::~RCUMap()
+    {
+        delete m_current.load();
+    }
+
+    ////////////////////////////////////////
+    //         READ-SIDE SECTIONS         //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Returns a small number unique to the calling thread, used to
+     *        spread readers across counter slots
+     */
+    template<typename Key, typename Value, typename Compare> unsigned RCUMap<Key, Value, Compare>::
+            thread_index()
+    {
+        static std::atomic_uint next(0);
+        static thread_local unsigned index = next++;
+        return index;
+    }
+
+    /*
+     * \brief Enters a read section and loads the current snapshot
+     * \param [out] map The snapshot to read
+     * \return Token identifying the counter to release in read_unlock
+     */
+    template<typename Key, typename Value, typename Compare> unsigned RCUMap<Key, Value, Compare>::
+            read_lock(const MapType*& map) const
+    {
+        unsigned slot = thread_index() & m_slotMask;
+        unsigned parity = m_epoch.load() & 1;
+
+        m_slots[slot].count[parity].fetch_add(1);
+        map = m_current.load();
+        return slot << 1 | parity;
+    }
+
+    /*
+     * \brief Leaves the read section entered by read_lock
+     */
+    template<typename Key, typename Value, typename Compare> void RCUMap<Key, Value, Compare>::
+            read_unlock(unsigned token) const
+    {
+        m_slots[token >> 1].count[token & 1].fetch_sub(1, std::memory_order_release);
+    }
+
+    ////////////////////////////////////////
+    //          WRITE-SIDE HELPERS        //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Spins until no reader holds a counter of the given parity
+     */
+    template<typename Key, typename Value, typename Compare> void RCUMap<Key, Value, Compare>::
+            wait_for_readers(unsigned parity) const
+    {
+        for (unsigned i = 0; i <= m_slotMask; i++) {
+            while (m_slots[i].count[parity].load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /*
+     * \brief Publishes a new snapshot and frees the old one once no reader
+     *        can still see it.  Assumes m_writeMutex is held.
+     *
+     * A reader that loaded the old pointer incremented a counter before the
+     * swap.  The first flip moves new readers to the other parity and waits
+     * out the old one; the second flip waits out readers that sampled the
+     * epoch just before the first flip but incremented after it.
+     */
+    template<typename Key, typename Value, typename Compare> void RCUMap<Key, Value, Compare>::
+            publish(MapType* next)
+    {
+        const MapType* old = m_current.exchange(next);
+
+        for (int flip = 0; flip < 2; flip++) {
+            wait_for_readers(m_epoch.fetch_add(1) & 1);
+        }
+        delete old;
+    }
+
+    ////////////////////////////////////////
+    //            READ METHODS            //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Returns a handle to the current snapshot.  Use this to make
+     *        several consistent reads or to iterate without copying.
+     */
+    template<typename Key, typename Value, typename Compare>
+            typename RCUMap<Key, Value, Compare>::Snapshot RCUMap<Key, Value, Compare>::
+            snapshot() const
+    {
+        return Snapshot(this);
+    }
+
+    /*
+     * \brief Retrieves a value from the map
+     * \param [in] k The key to query the map with
+     *
+     * \return The value correspoding to Key k
+     */
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> RCUMap<Key, Value, Compare>::
+            find(const Key& k) const
+    {
+        Snapshot snap(this);
+        auto it = snap->find(k);
+
+        if (it != snap->end()) {
+            return std::make_pair(it->second, true);
+        }
+        return std::make_pair(Value{}, false);
+    }
+
+    /*
+     * \brief Retrieves the first value with a key not less than the given k
+     * \param [in] k The key to query the map with
+     */
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> RCUMap<Key, Value, Compare>::
+            lower_bound(const Key& k) const
+    {
+        Snapshot snap(this);
+        auto it = snap->lower_bound(k);
+
+        if (it != snap->end()) {
+            return std::make_pair(it->second, true);
+        }
+        return std::make_pair(Value{}, false);
+    }
+
+    /**
+     * \brief Calls f(const Key&, const Value&) on the entry for k without
+     *        copying it
+     * \return true if the key was found and f was called
+     **/
+    template<typename Key, typename Value, typename Compare>
+    template<typename F> bool RCUMap<Key, Value, Compare>::
+            visit(const Key& k, F f) const
+    {
+        Snapshot snap(this);
+        auto it = snap->find(k);
+
+        if (it == snap->end()) {
+            return false;
+        }
+        f(it->first, it->second);
+        return true;
+    }
+
+    /*
+     * \brief returns the number of entries in the map
+     */
+    template<typename Key, typename Value, typename Compare> size_t RCUMap<Key, Value, Compare>::
+            size() const
+    {
+        return snapshot()->size();
+    }
+
+    /*
+     * \brief checks if the map is empty
+     */
+    template<typename Key, typename Value, typename Compare> bool RCUMap<Key, Value, Compare>::
+            empty() const
+    {
+        return snapshot()->empty();
+    }
+
+    template<typename Key, typename Value, typename Compare> std::vector<Key> RCUMap<Key, Value, Compare>::
+            getKeyList() const
+    {
+        std::vector<Key> keyList;
+        Snapshot snap(this);
+
+        for (auto it = snap->cbegin(); it != snap->cend(); it++) {
+            keyList.push_back(it->first);
+        }
+        return keyList;
+    }
+
+    /*
+     * \brief Applies f to every element of the current snapshot
+     * \param [in] f The function to apply to each element in the map;
+     *               should return true on success, false on failure
+     * \return number of successful returns from f
+     */
+    template<typename Key, typename Value, typename Compare> size_t RCUMap<Key, Value, Compare>::
+            for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const
+    {
+        size_t numSuccess = 0;
+        Snapshot snap(this);
+
+        for (auto it = snap->cbegin(); it != snap->cend(); it++) {
+            if (f(it->first, it->second)) {
+                numSuccess++;
+            }
+        }
+        return numSuccess;
+    }
+
+    ////////////////////////////////////////
+    //           WRITE METHODS            //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Add a key-value pair to the map
+     * \param [in] k The key associated with Value v
+     * \param [in] v The value to insert into the map
+     * \param [in] force Overwrite the value if the key already exists
+     *
+     * return true if no element previously existed or force was set
+     */
+    template<typename Key, typename Value, typename Compare> bool RCUMap<Key, Value, Compare>::
+            emplace(const Key& k, Value v, bool force)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        const MapType* current = m_current.load();
+
+        if (!force && current->count(k)) {
+            return false;
+        }
+
+        MapType* next = new MapType(*current);
+        (*next)[k] = std::move(v);
+        publish(next);
+        return true;
+    }
+
+    /*
+     * \brief Add a key-value pair to the map
+     *
+     * \return pair containing the value previously stored for k (or v if
+     * there was none) and true if no element previously existed
+     */
+    template<typename Key, typename Value, typename Compare> std::pair<Value,bool> RCUMap<Key, Value, Compare>::
+            replace(const Key& k, Value v, bool force)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        const MapType* current = m_current.load();
+        auto it = current->find(k);
+
+        if (it != current->end()) {
+            std::pair<Value, bool> ret(it->second, false);
+            if (force) {
+                MapType* next = new MapType(*current);
+                (*next)[k] = std::move(v);
+                publish(next);
+            }
+            return ret;
+        }
+
+        MapType* next = new MapType(*current);
+        next->emplace(k, v);
+        publish(next);
+        return std::make_pair(v, true);
+    }
+
+    /*
+     * \brief Erases an entry from the map
+     * \return true if the element was erased, false if it did not exist
+     */
+    template<typename Key, typename Value, typename Compare> bool RCUMap<Key, Value, Compare>::
+            erase(const Key& k)
+    {
+        return remove(k).second;
+    }
+
+    /**
+     * \brief Returns the value associated with a key and erases it from the map
+     * \return A pair of the value and a bool to indicate success
+     **/
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> RCUMap<Key, Value, Compare>::
+            remove(const Key& k)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        const MapType* current = m_current.load();
+        auto it = current->find(k);
+
+        if (it == current->end()) {
+            return std::make_pair(Value{}, false);
+        }
+
+        std::pair<Value, bool> ret(it->second, true);
+        MapType* next = new MapType(*current);
+        next->erase(k);
+        publish(next);
+        return ret;
+    }
+
+    /*
+     * \brief Applies an arbitrary modification to a copy of the map and
+     *        publishes the result, so a batch of changes costs one copy and
+     *        readers see all of them at once
+     * \param [in] f Function that edits the new version in place
+     */
+    template<typename Key, typename Value, typename Compare> void RCUMap<Key, Value, Compare>::
+            update(std::function<void(MapType& m)> f)
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        std::unique_ptr<MapType> next(new MapType(*m_current.load()));
+
+        f(*next);
+        publish(next.release());
+    }
+
+    /*
+     * \brief Clears all entries from the map
+     */
+    template<typename Key, typename Value, typename Compare> void RCUMap<Key, Value, Compare>::
+            clear()
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        publish(new MapType(m_current.load()->key_comp()));
+    }
+}
@@ -0,0 +1,187 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file SPSCQueue.tcc
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+#ifndef ACL_CACHE_LINE_SIZE
+#define ACL_CACHE_LINE_SIZE 64
+#endif
+
+namespace acl
+{
+
+/**
+* @brief A bounded single-producer/single-consumer queue
+*
+* Exactly one thread may call enqueue() and exactly one (other) thread may
+* call dequeue().  Both operations are wait-free while the queue is neither
+* full nor empty: the producer and consumer only publish their own index and
+* read the other's, and the indices live on separate cache lines.
+*
+* The mutex and condition variable are only used when the consumer has to
+* block in dequeue(); the producer checks a flag after publishing and only
+* signals when the consumer is actually asleep.
+*
+* @tparam T The type of data to be contained in the queue.  Must be default
+*         constructible and assignable.
+*/
+template <typename T> class SPSCQueue
+{
+public:
+    SPSCQueue(size_t maxSize = 1024);                     //<! Constructor
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    bool enqueue(const T& data) { return store(data); }             //<! Copy data to the tail (producer only)
+    bool enqueue(T&& data) { return store(std::move(data)); }       //<! Move data to the tail (producer only)
+    bool dequeue(T& data, uint16_t timeout = 0);          //<! Remove data from the head (consumer only)
+    size_t size() const;                                  //<! Return the size of the queue
+    size_t get_max_size() const;                          //<! Returns max size
+
+protected:
+    template<typename U> bool store(U&& data);            //<! Shared body of both enqueue overloads
+
+    // Consumer owned
+    std::atomic_size_t m_head;                            //<! Index of the next element to dequeue
+    size_t m_tailCache;                                   //<! Consumer's last view of m_tail
+    char m_pad0[ACL_CACHE_LINE_SIZE];
+
+    // Producer owned
+    std::atomic_size_t m_tail;                            //<! Index of the next free slot
+    size_t m_headCache;                                   //<! Producer's last view of m_head
+    char m_pad1[ACL_CACHE_LINE_SIZE];
+
+    // Shared, read-mostly
+    std::atomic_bool m_sleeping;                          //<! True while the consumer is blocked
+    std::mutex m_mutex;                                   //<! Only taken to sleep or to wake the consumer
+    std::condition_variable m_cv;                         //<! Signalled when data arrives for a sleeping consumer
+    size_t m_maxSize;                                     //<! Maximum number of elements
+    size_t m_mask;                                        //<! Slot count - 1 (slot count is a power of 2)
+    std::vector<T> m_slots;                               //<! Ring storage
+};
+
+/**
+* @brief Constructor.  Preallocates the ring.
+*
+* @param maxSize The maximum number of elements the queue will hold
+**/
+template<typename T> SPSCQueue<T>::SPSCQueue(size_t maxSize)
+    : m_head(0), m_tailCache(0), m_tail(0), m_headCache(0), m_sleeping(false),
+      m_maxSize(maxSize ? maxSize : 1)
+{
+    size_t slots = 1;
+    while (slots < m_maxSize) {
+        slots <<= 1;
+    }
+
+    m_mask = slots - 1;
+    m_slots.resize(slots);
+}
+
+/**
+* @brief Adds data to the tail of the queue.  Must only be called from the
+*        producer thread.
+*
+* @param data The data to add
+* @return false if the queue is full
+*/
+template<typename T>
+template<typename U> bool SPSCQueue<T>::store(U&& data)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+
+    if (tail - m_headCache >= m_maxSize) {
+        m_headCache = m_head.load(std::memory_order_acquire);
+        if (tail - m_headCache >= m_maxSize) {
+            return false;
+        }
+    }
+
+    m_slots[tail & m_mask] = std::forward<U>(data);
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    // Pairs with the fence in dequeue so either we see the sleeping flag or
+    // the consumer sees the new tail before it blocks
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+    }
+    return true;
+}
+
+/**
+* @brief Removes and returns the head of the queue.  Must only be called from
+*        the consumer thread.  Blocks if no data is available.
+*
+* @param data Receives the head of the queue
+* @param timeout How long to block before timeout in milliseconds.
+*
+* @return false if no data arrived before the timeout
+*/
+template<typename T> bool SPSCQueue<T>::dequeue(T& data, uint16_t timeout)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+
+    if (head == m_tailCache) {
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+
+        if (head == m_tailCache) {
+            if (!timeout) {
+                return false;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool ready = m_cv.wait_for(lock, std::chrono::milliseconds(timeout), [this, head] {
+                m_tailCache = m_tail.load(std::memory_order_acquire);
+                return head != m_tailCache;
+            });
+
+            m_sleeping.store(false, std::memory_order_relaxed);
+            if (!ready) {
+                return false;
+            }
+        }
+    }
+
+    data = std::move(m_slots[head & m_mask]);
+    m_slots[head & m_mask] = T{};
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+* @brief Returns the number of items in the queue.  Only a snapshot when
+*        called while the producer or consumer is active.
+*/
+template<typename T> size_t SPSCQueue<T>::size() const
+{
+    size_t head = m_head.load(std::memory_order_acquire);
+    return m_tail.load(std::memory_order_acquire) - head;
+}
+
+/**
+* @brief Returns the maximum number of items the queue can hold
+*/
+template<typename T> size_t SPSCQueue<T>::get_max_size() const
+{
+    return m_maxSize;
+}
+}
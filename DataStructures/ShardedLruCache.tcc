@@ -0,0 +1,443 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file ShardedLruCache.tcc
+ **/
+
+#pragma once
+
+#include "HashLruCache.tcc"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace acl
+{
+
+/**
+ * @brief A thread-safe LRU cache split into independently locked segments
+ *
+ * Each key hashes to one of N HashLruCache shards, and each shard gets an
+ * equal share of the capacity, so lookups on different shards never touch
+ * the same lock.  Eviction is LRU within a shard rather than across the
+ * whole cache, and the total capacity (in entries and in weight) is
+ * rounded up to a multiple of N.
+ *
+ * An entry heavier than one shard's share of the weight capacity is still
+ * admitted as long as it fits the total: it evicts everything else in its
+ * shard and is itself evicted by the next insert there.  Such an entry
+ * briefly takes the cache over its total weight, by at most its own
+ * weight less one share.
+ *
+ * @tparam K The key class used to access elements
+ * @tparam V The cached object type
+ * @tparam Hash Hash function for K
+ * @tparam Mutex The lock of each shard, see HashLruCache
+ */
+template<class K, class V, class Hash = std::hash<K>, class Mutex = CacheMutex> class ShardedLruCache
+{
+public:
+    typedef HashLruCache<K,V,Hash,Mutex> Shard;
+
+    ShardedLruCache(unsigned numShards = 16, size_t maxSize = SIZE_MAX);
+    virtual ~ShardedLruCache() { stopAsyncCleanup(); }
+    virtual bool add_to_cache(K, V);
+    virtual bool get_value(K, V&);
+    virtual V get_or_load(K key, std::function<V(void)> loader);
+    virtual void empty_cache();
+    virtual void setCleanupHandler(std::function<bool(K, V)> handler=nullptr);
+    virtual bool startAsyncCleanup(unsigned numThreads = 1, size_t maxPending = 1024);
+    virtual void stopAsyncCleanup();
+    virtual size_t size();
+    virtual void set_max_size(size_t);
+    virtual size_t get_max_size();
+    virtual void setWeightFunction(std::function<size_t(const K&, const V&)> weigher=nullptr);
+    virtual void set_max_weight(size_t);
+    virtual size_t get_max_weight();
+    virtual size_t get_weight();
+    virtual CacheStats get_stats();
+    virtual void reset_stats();
+    virtual bool setEvictionPolicy(EvictionPolicy policy);
+    virtual EvictionPolicy getEvictionPolicy();
+    virtual bool setClockRecency(bool enable);
+    virtual bool getClockRecency();
+    void set_lock_name(const std::string& name);
+    unsigned get_num_shards() const;
+
+protected:
+    Shard& shard_for(const K& key);         //<! Returns the shard owning a key
+    size_t share(size_t total) const;       //<! Splits a capacity between the shards
+
+    std::vector<std::unique_ptr<Shard>> m_shards; //<! Independent LRU segments
+    unsigned m_shardBits;                   //<! log2 of the number of shards
+    size_t m_maxSize;                       //<! Capacity across all shards
+    size_t m_maxWeight = SIZE_MAX;          //<! Weight capacity across all shards
+    Hash m_hash;                            //<! Hashes keys to shards
+
+    std::mutex m_cleanupMutex;              //<! Guards m_cleanupPool
+    std::shared_ptr<ThreadPool> m_cleanupPool; //<! Cleanup workers shared by every shard
+};
+
+/**
+ * @brief Constructor
+ *
+ * @param numShards Number of segments, rounded up to a power of 2
+ * @param maxSize Capacity across all shards
+ */
+template<class K, class V, class Hash, class Mutex> ShardedLruCache<K,V,Hash,Mutex>::
+ShardedLruCache(unsigned numShards, size_t maxSize): m_shardBits(0)
+{
+    while ((1u << m_shardBits) < numShards) {
+        m_shardBits++;
+    }
+    for (unsigned i = 0; i < (1u << m_shardBits); i++) {
+        m_shards.emplace_back(new Shard);
+    }
+    set_max_size(maxSize);
+}
+
+/**
+ * @brief Empties every shard
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+empty_cache()
+{
+    for (auto& shard : m_shards) {
+        shard->empty_cache();
+    }
+}
+
+/**
+ * @brief Sets the function that is called when something is booted from the cache
+ *
+ * If this function returns false when called, the object will not be booted from the cache!
+ *
+ * @param std::function handler the function, shared by all shards
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+setCleanupHandler(std::function<bool(K,V)> handler)
+{
+    for (auto& shard : m_shards) {
+        shard->setCleanupHandler(handler);
+    }
+}
+
+/**
+ * @brief Runs the cleanup handler of every shard on one pool of background
+ *      workers.  See HashLruCache::startAsyncCleanup().
+ *
+ * @param numThreads Number of workers shared by all shards
+ * @param maxPending Evictions from all shards that may wait for a worker
+ *
+ * @return false, with every shard left cleaning up synchronously, if
+ *      asynchronous cleanup is already running or could not be started
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+startAsyncCleanup(unsigned numThreads, size_t maxPending)
+{
+    std::lock_guard<std::mutex> lock(m_cleanupMutex);
+    if (m_cleanupPool) {
+        return false;
+    }
+
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(numThreads, (int)maxPending);
+    if (!pool->Start()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        if (!m_shards[i]->startAsyncCleanup(pool)) {
+            std::cerr << "ShardedLruCache::startAsyncCleanup ERROR: shard " << i << " is already running" << std::endl;
+            while (i-- > 0) {
+                m_shards[i]->stopAsyncCleanup();
+            }
+            pool->Stop();
+            pool->Join();
+            return false;
+        }
+    }
+    m_cleanupPool = pool;
+    return true;
+}
+
+/**
+ * @brief Waits for every shard's pending evictions to be cleaned up and
+ *      stops its workers
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+stopAsyncCleanup()
+{
+    std::lock_guard<std::mutex> lock(m_cleanupMutex);
+    for (auto& shard : m_shards) {
+        shard->stopAsyncCleanup();
+    }
+
+    if (m_cleanupPool) {
+        m_cleanupPool->Stop();
+        m_cleanupPool->Join();
+        m_cleanupPool.reset();
+    }
+}
+
+/**
+ * @brief Returns the number of entries across all shards
+ */
+template<class K, class V, class Hash, class Mutex> size_t ShardedLruCache<K,V,Hash,Mutex>::
+size()
+{
+    size_t total = 0;
+    for (auto& shard : m_shards) {
+        total += shard->size();
+    }
+    return total;
+}
+
+/**
+ * @brief Sets the capacity, split evenly between the shards
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+set_max_size(size_t maxSize)
+{
+    m_maxSize = maxSize;
+    for (auto& shard : m_shards) {
+        shard->set_max_size(share(maxSize));
+    }
+}
+
+/**
+ * @brief Returns the capacity across all shards
+ */
+template<class K, class V, class Hash, class Mutex> size_t ShardedLruCache<K,V,Hash,Mutex>::
+get_max_size()
+{
+    return m_maxSize;
+}
+
+/**
+ * @brief Sets the function that weighs entries against set_max_weight()
+ *
+ * @param weigher Returns the weight of a key and value, e.g. its size in
+ *      bytes.  Shared by all shards.
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+setWeightFunction(std::function<size_t(const K&, const V&)> weigher)
+{
+    for (auto& shard : m_shards) {
+        shard->setWeightFunction(weigher);
+    }
+}
+
+/**
+ * @brief Sets the capacity in weight, split evenly between the shards
+ *
+ * Each shard holds at most maxWeight / N, but a single entry up to
+ * maxWeight is admitted into an otherwise emptied shard (see the class
+ * comment), so large values do not need the capacity scaled by N.
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+set_max_weight(size_t maxWeight)
+{
+    m_maxWeight = maxWeight;
+    for (auto& shard : m_shards) {
+        shard->set_max_weight(share(maxWeight));
+        shard->set_max_entry_weight(maxWeight);
+    }
+}
+
+/**
+ * @brief Returns the capacity in weight across all shards
+ */
+template<class K, class V, class Hash, class Mutex> size_t ShardedLruCache<K,V,Hash,Mutex>::
+get_max_weight()
+{
+    return m_maxWeight;
+}
+
+/**
+ * @brief Returns the total weight cached across all shards
+ */
+template<class K, class V, class Hash, class Mutex> size_t ShardedLruCache<K,V,Hash,Mutex>::
+get_weight()
+{
+    size_t total = 0;
+    for (auto& shard : m_shards) {
+        total += shard->get_weight();
+    }
+    return total;
+}
+
+/**
+ * @brief Returns the counters summed over all shards
+ */
+template<class K, class V, class Hash, class Mutex> CacheStats ShardedLruCache<K,V,Hash,Mutex>::
+get_stats()
+{
+    CacheStats total;
+    for (auto& shard : m_shards) {
+        CacheStats stats = shard->get_stats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.evictions += stats.evictions;
+        total.rejections += stats.rejections;
+        total.entries += stats.entries;
+        total.weight += stats.weight;
+    }
+    return total;
+}
+
+/**
+ * @brief Zeroes the hit, miss and eviction counters of every shard
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+reset_stats()
+{
+    for (auto& shard : m_shards) {
+        shard->reset_stats();
+    }
+}
+
+/**
+ * @brief Sets the eviction policy of every shard
+ *
+ * @return false if the shards refused it, see HashLruCache::setEvictionPolicy()
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+setEvictionPolicy(EvictionPolicy policy)
+{
+    bool set = true;
+    for (auto& shard : m_shards) {
+        set &= shard->setEvictionPolicy(policy);
+    }
+    return set;
+}
+
+/**
+ * @brief Returns the eviction policy
+ */
+template<class K, class V, class Hash, class Mutex> EvictionPolicy ShardedLruCache<K,V,Hash,Mutex>::
+getEvictionPolicy()
+{
+    return m_shards[0]->getEvictionPolicy();
+}
+
+/**
+ * @brief Chooses between exact LRU order and CLOCK reference bits in every
+ *      shard.  See HashLruCache::setClockRecency().
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+setClockRecency(bool enable)
+{
+    bool set = true;
+    for (auto& shard : m_shards) {
+        set &= shard->setClockRecency(enable);
+    }
+    return set;
+}
+
+/**
+ * @brief Returns true if hits set CLOCK reference bits
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+getClockRecency()
+{
+    return m_shards[0]->getClockRecency();
+}
+
+/**
+ * @brief Names the shard locks "name[i]" in the LockRegistry.  Does
+ *        nothing unless built with DEBUG_CACHE.
+ */
+template<class K, class V, class Hash, class Mutex> void ShardedLruCache<K,V,Hash,Mutex>::
+set_lock_name(const std::string& name)
+{
+    for (size_t i = 0; i < m_shards.size(); i++) {
+        m_shards[i]->set_lock_name(name + "[" + std::to_string(i) + "]");
+    }
+}
+
+/**
+ * @brief Returns the number of shards
+ */
+template<class K, class V, class Hash, class Mutex> unsigned ShardedLruCache<K,V,Hash,Mutex>::
+get_num_shards() const
+{
+    return (unsigned)m_shards.size();
+}
+
+/**
+ * @brief Retrieves the value pointed to by this key
+ *
+ * @param key The key
+ * @param[in] val The return value
+ *
+ * @return true on success.  False if no key exists or a cache miss
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+get_value(K key, V& val)
+{
+    Shard& shard = shard_for(key);
+    return shard.get_value(std::move(key), val);
+}
+
+/**
+ * @brief Retrieves the value pointed to by this key, loading it into its
+ *      shard on a miss.  See HashLruCache::get_or_load().
+ */
+template<class K, class V, class Hash, class Mutex> V ShardedLruCache<K,V,Hash,Mutex>::
+get_or_load(K key, std::function<V(void)> loader)
+{
+    Shard& shard = shard_for(key);
+    return shard.get_or_load(std::move(key), std::move(loader));
+}
+
+/**
+ * @brief Adds a key and value to its shard, evicting that shard's least
+ *      recently used entries if it is full.
+ *
+ * @return false if the key is already cached
+ */
+template<class K, class V, class Hash, class Mutex> bool ShardedLruCache<K,V,Hash,Mutex>::
+add_to_cache(K key, V value)
+{
+    Shard& shard = shard_for(key);
+    return shard.add_to_cache(std::move(key), std::move(value));
+}
+
+/**
+ * @brief Returns each shard's part of a capacity, rounded up
+ */
+template<class K, class V, class Hash, class Mutex> size_t ShardedLruCache<K,V,Hash,Mutex>::
+share(size_t total) const
+{
+    if (total == SIZE_MAX) {
+        return SIZE_MAX;
+    }
+    return (total + m_shards.size() - 1) / m_shards.size();
+}
+
+/**
+ * @brief Returns the shard owning a key.
+ *
+ * The hash is scrambled so weak hashes (such as the identity std::hash for
+ * integers) spread over the shards, and the top bits pick the shard so
+ * the shard's own index sees independent low bits.
+ */
+template<class K, class V, class Hash, class Mutex> typename ShardedLruCache<K,V,Hash,Mutex>::Shard& ShardedLruCache<K,V,Hash,Mutex>::
+shard_for(const K& key)
+{
+    if (!m_shardBits) {
+        return *m_shards[0];
+    }
+
+    uint64_t h = m_hash(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return *m_shards[h >> (64 - m_shardBits)];
+}
+}
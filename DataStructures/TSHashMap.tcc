@@ -0,0 +1,620 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file TSHashMap.tcc
+ **/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "shared_mutex.h"
+
+namespace acl
+{
+
+    /*
+     * \brief Threadsafe hash map split into independently locked shards
+     *
+     * Each key is hashed to one of N shards.  Every shard is an open
+     * addressing (linear probing) table guarded by its own acl::shared_mutex,
+     * so operations on different shards never contend and lookups touch a
+     * single contiguous array instead of chasing tree nodes.
+     *
+     * The interface mirrors TSMap minus the ordered queries.  Functions that
+     * visit every element (size, for_each, delete_if, ...) lock one shard at a
+     * time, so they do not observe a single atomic snapshot of the map.
+     *
+     * Key and Value must be default constructible.
+     */
+    template<typename Key, typename Value, typename Hash = std::hash<Key>> class TSHashMap
+    {
+        protected:
+            struct Slot {
+                Key     key{};
+                Value   value{};
+                size_t  hash = 0;       //!< Mixed hash of key
+                bool    used = false;   //!< True if the slot holds an entry
+            };
+
+            struct Shard {
+                mutable shared_mutex    mutex;      //!< Guards this shard only
+                std::vector<Slot>       slots;      //!< Table, size is a power of 2
+                size_t                  count = 0;  //!< Number of used slots
+            };
+
+            std::vector<std::unique_ptr<Shard>> m_shards;   //!< Lock stripes
+            unsigned                            m_shardBits; //!< log2 of the number of shards
+            Hash                                m_hash;     //!< Key hasher
+
+            static const size_t MIN_SLOTS = 8;              //!< Smallest table per shard
+
+            size_t  mix(const Key& k) const;
+            Shard&  shard_for(size_t hash) const;
+            size_t  probe(const Shard& s, const Key& k, size_t hash, bool& found) const;
+            void    grow(Shard& s);
+            void    erase_slot(Shard& s, size_t index);
+            template<typename... Args>
+            bool    insert(Shard& s, size_t hash, const Key& k, Args&&... args);
+
+        public:
+            TSHashMap(unsigned numShards = 16, size_t expectedSize = 0);
+            virtual ~TSHashMap();
+
+            // read functions
+            std::pair<Value, bool>  find(const Key& k) const;
+            size_t                  size() const;
+            bool                    empty() const;
+            std::vector<Key>        getKeyList() const;
+
+            // write functions
+            bool                    emplace(const Key& k, Value v, bool force = false);
+            template<typename... Args>
+            bool                    createInPlace(const Key& k, Args... args);
+            std::pair<Value,bool>   replace(const Key& k, Value v, bool force = true);
+            bool                    erase(const Key& k, std::function<bool(const Key&,Value&)> f = nullptr);
+            std::pair<Value, bool>  remove(const Key& k);
+
+            bool                    perform(const Key& k, std::function<bool(const Key&,Value&)> f = nullptr);
+            bool                    perform_ro(const Key& k, std::function<bool(const Key&,const Value&)> f = nullptr) const;
+            void                    clear();
+
+            // function iterators
+            size_t for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const;
+            size_t for_each(std::function<bool(const Key& k, Value& v)> f);
+            size_t delete_if(std::function<bool(const Key& k, Value& v)> f);
+
+            void   set_lock_name(const std::string& name);
+    };
+
+    /**
+     * \brief Constructor
+     * \param numShards Number of lock stripes, rounded up to a power of 2.
+     *        More shards reduce writer contention at the cost of memory.
+     * \param expectedSize Number of entries to presize the shards for
+     **/
+    template<typename Key, typename Value, typename Hash>
+            TSHashMap<Key, Value, Hash>::TSHashMap(unsigned numShards, size_t expectedSize)
+        : m_shardBits(0)
+    {
+        while ((1u << m_shardBits) < numShards) {
+            m_shardBits++;
+        }
+
+        size_t slots = MIN_SLOTS;
+        while (slots * 7 / 10 < (expectedSize >> m_shardBits)) {
+            slots <<= 1;
+        }
+
+        for (unsigned i = 0; i < (1u << m_shardBits); i++) {
+            m_shards.emplace_back(new Shard);
+            m_shards.back()->slots.resize(slots);
+        }
+    }
+
+    /**
+     * \brief Destructor. Clears the map
+     */
+    template<typename Key, typename Value, typename Hash> TSHashMap<Key, Value, Hash>::~TSHashMap()
+    {
+        clear();
+    }
+
+    /**
+     * \brief Names the shard locks "name[i]" in the LockRegistry.  Does
+     *        nothing unless built with DEBUG_CACHE.
+     */
+    template<typename Key, typename Value, typename Hash> void TSHashMap<Key, Value, Hash>::
+            set_lock_name(const std::string& name)
+    {
+        for (size_t i = 0; i < m_shards.size(); i++) {
+            m_shards[i]->mutex.set_lock_name(name + "[" + std::to_string(i) + "]");
+        }
+    }
+
+    ////////////////////////////////////////
+    //          INTERNAL HELPERS          //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Hashes a key and scrambles the result so that weak hashes (such
+     *        as the identity std::hash for integers) spread over shards and slots
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            mix(const Key& k) const
+    {
+        uint64_t h = m_hash(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (size_t)h;
+    }
+
+    /*
+     * \brief Returns the shard owning a hash.  Uses the top bits so the low
+     *        bits stay independent for slot selection.
+     */
+    template<typename Key, typename Value, typename Hash>
+            typename TSHashMap<Key, Value, Hash>::Shard& TSHashMap<Key, Value, Hash>::
+            shard_for(size_t hash) const
+    {
+        if (!m_shardBits) {
+            return *m_shards[0];
+        }
+        return *m_shards[hash >> (sizeof(size_t) * 8 - m_shardBits)];
+    }
+
+    /*
+     * \brief Linear probe for a key.  Caller must hold the shard lock.
+     * \param [out] found true if the key is present
+     * \return Index of the key if found, else of the empty slot that ends the probe
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            probe(const Shard& s, const Key& k, size_t hash, bool& found) const
+    {
+        size_t mask = s.slots.size() - 1;
+        size_t i = hash & mask;
+
+        while (s.slots[i].used) {
+            if (s.slots[i].hash == hash && s.slots[i].key == k) {
+                found = true;
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+
+        found = false;
+        return i;
+    }
+
+    /*
+     * \brief Doubles a shard's table and reinserts its entries.  Caller must
+     *        hold the shard lock exclusively.
+     */
+    template<typename Key, typename Value, typename Hash> void TSHashMap<Key, Value, Hash>::
+            grow(Shard& s)
+    {
+        std::vector<Slot> old(s.slots.size() * 2);
+        old.swap(s.slots);
+        size_t mask = s.slots.size() - 1;
+
+        for (auto& slot : old) {
+            if (!slot.used) {
+                continue;
+            }
+
+            size_t i = slot.hash & mask;
+            while (s.slots[i].used) {
+                i = (i + 1) & mask;
+            }
+            s.slots[i] = std::move(slot);
+        }
+    }
+
+    /*
+     * \brief Inserts a key that is known to be absent, constructing the value
+     *        from args.  Caller must hold the shard lock exclusively.
+     */
+    template<typename Key, typename Value, typename Hash>
+    template<typename... Args> bool TSHashMap<Key, Value, Hash>::
+            insert(Shard& s, size_t hash, const Key& k, Args&&... args)
+    {
+        if ((s.count + 1) * 10 > s.slots.size() * 7) {
+            grow(s);
+        }
+
+        bool found;
+        Slot& slot = s.slots[probe(s, k, hash, found)];
+        slot.key = k;
+        slot.value = Value(std::forward<Args>(args)...);
+        slot.hash = hash;
+        slot.used = true;
+        s.count++;
+        return true;
+    }
+
+    /*
+     * \brief Removes the entry at index, shifting later members of its probe
+     *        run back so no tombstones are needed.  Caller must hold the shard
+     *        lock exclusively.
+     */
+    template<typename Key, typename Value, typename Hash> void TSHashMap<Key, Value, Hash>::
+            erase_slot(Shard& s, size_t index)
+    {
+        size_t mask = s.slots.size() - 1;
+        size_t hole = index;
+        size_t i = index;
+
+        while (true) {
+            i = (i + 1) & mask;
+            if (!s.slots[i].used) {
+                break;
+            }
+
+            // Leave the entry alone if its home slot lies cyclically in (hole, i]
+            size_t home = s.slots[i].hash & mask;
+            bool inRun = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (!inRun) {
+                s.slots[hole] = std::move(s.slots[i]);
+                hole = i;
+            }
+        }
+
+        s.slots[hole] = Slot();
+        s.count--;
+    }
+
+    ////////////////////////////////////////
+    //            READ METHODS            //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Retrieves a value from the map
+     * \param [in] k The key to query the map with
+     *
+     * \return The value correspoding to Key k
+     */
+    template<typename Key, typename Value, typename Hash> std::pair<Value, bool> TSHashMap<Key, Value, Hash>::
+            find(const Key& k) const
+    {
+        size_t hash = mix(k);
+        const Shard& s = shard_for(hash);
+        acl::shared_lock lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (found) {
+            return std::make_pair(s.slots[i].value, true);
+        }
+        return std::make_pair(Value{}, false);
+    }
+
+    /*
+     * \brief returns the number of entries in the map
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            size() const
+    {
+        size_t total = 0;
+        for (auto& s : m_shards) {
+            acl::shared_lock lock(s->mutex);
+            total += s->count;
+        }
+        return total;
+    }
+
+    /*
+     * \brief checks if the map is empty
+     */
+    template<typename Key, typename Value, typename Hash> bool TSHashMap<Key, Value, Hash>::
+            empty() const
+    {
+        return size() == 0;
+    }
+
+    template<typename Key, typename Value, typename Hash> std::vector<Key> TSHashMap<Key, Value, Hash>::
+            getKeyList() const
+    {
+        std::vector<Key> keyList;
+        for_each_ro([&keyList](Key k, const Value&) {
+            keyList.push_back(k);
+            return true;
+        });
+        return keyList;
+    }
+
+    ////////////////////////////////////////
+    //           WRITE METHODS            //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Add a key-value pair to the map
+     * \param [in] k The key associated with Value v
+     * \param [in] v The value to insert into the map
+     * \param [in] force Overwrite the value if the key already exists
+     *
+     * return true if no element previously existed, false if one did
+     */
+    template<typename Key, typename Value, typename Hash> bool TSHashMap<Key, Value, Hash>::
+            emplace(const Key& k, Value v, bool force)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (found) {
+            if (force) {
+                s.slots[i].value = std::move(v);
+                return true;
+            }
+            return false;
+        }
+        return insert(s, hash, k, std::move(v));
+    }
+
+    /*
+     * \brief Create a value in place in the map
+     * \param [in] k The key associated with Value v
+     * \param [in] args the arguments to the constructor of the Value
+     *
+     * return true if the value was successfully created
+     */
+    template<typename Key, typename Value, typename Hash>
+    template<typename... Args> bool TSHashMap<Key, Value, Hash>::
+            createInPlace(const Key& k, Args... args)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        probe(s, k, hash, found);
+        if (found) {
+            return false;
+        }
+        return insert(s, hash, k, args...);
+    }
+
+    /*
+     * \brief Add a key-value pair to the map
+     * \param [in] k The key associated with Value v
+     * \param [in] v The value to insert into the map
+     *
+     * \return pair containing value previously in the specified index
+     * and bool containing true if no element previously existed, false if one
+     * did previously exist
+     *
+     * note: if nothing was in this location previously, the return Value will
+     * be the value that was passed in.
+     */
+    template<typename Key, typename Value, typename Hash> std::pair<Value,bool> TSHashMap<Key, Value, Hash>::
+            replace(const Key& k, Value v, bool force)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (found) {
+            Value old = s.slots[i].value;
+            if (force) {
+                s.slots[i].value = std::move(v);
+            }
+            return std::make_pair(old, false);
+        }
+
+        insert(s, hash, k, v);
+        return std::make_pair(v, true);
+    }
+
+    /*
+     * \brief Erases an entry from the map
+     * \param [in] k The key of the entry to erase
+     * \param [in] f The function to perform on the key-value pair.
+     * If this function returns false, the entry will not be erased
+     *
+     * \return true if the element was erased, false otherwise
+     */
+    template<typename Key, typename Value, typename Hash> bool TSHashMap<Key, Value, Hash>::
+            erase(const Key& k, std::function<bool(const Key&,Value&)> f)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (!found || (f && !f(k, s.slots[i].value))) {
+            return false;
+        }
+
+        erase_slot(s, i);
+        return true;
+    }
+
+    /**
+     * \brief Returns the value associated with a key and erases it from the map;
+     *        If the key is not found, nothing is erased
+     * \param[in] k The key to find, return, and remove
+     * \return A pair of the value and a bool to indicate success
+     **/
+    template<typename Key, typename Value, typename Hash> std::pair<Value, bool> TSHashMap<Key, Value, Hash>::
+            remove(const Key& k)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (!found) {
+            return std::make_pair(Value{}, false);
+        }
+
+        auto ret = std::make_pair(std::move(s.slots[i].value), true);
+        erase_slot(s, i);
+        return ret;
+    }
+
+    /*
+     * \brief performs the given function on the key value pair specified
+     * \param [in] k The key of the entry to operate on
+     * \param [in] f The function to perform
+     *
+     * \return The value returned by the fucntion
+     */
+    template<typename Key, typename Value, typename Hash> bool TSHashMap<Key, Value, Hash>::
+            perform(const Key& k, std::function<bool(const Key&,Value&)> f)
+    {
+        size_t hash = mix(k);
+        Shard& s = shard_for(hash);
+        std::lock_guard<acl::shared_mutex> lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (!found || !f) {
+            return false;
+        }
+        return f(k, s.slots[i].value);
+    }
+
+    /*
+     * \brief performs the given function on the key value pair specified (read-only)
+     * \param [in] k The key of the entry to operate on
+     * \param [in] f The (read-only) function to perform
+     *
+     * \return The value returned by the fucntion
+     */
+    template<typename Key, typename Value, typename Hash> bool TSHashMap<Key, Value, Hash>::
+            perform_ro(const Key& k, std::function<bool(const Key&,const Value&)> f) const
+    {
+        size_t hash = mix(k);
+        const Shard& s = shard_for(hash);
+        acl::shared_lock lock(s.mutex);
+
+        bool found;
+        size_t i = probe(s, k, hash, found);
+        if (!found || !f) {
+            return false;
+        }
+        return f(k, s.slots[i].value);
+    }
+
+    /*
+     * \brief Clears all entries from the map
+     */
+    template<typename Key, typename Value, typename Hash> void TSHashMap<Key, Value, Hash>::
+            clear()
+    {
+        for (auto& s : m_shards) {
+            std::lock_guard<acl::shared_mutex> lock(s->mutex);
+            std::vector<Slot>(s->slots.size()).swap(s->slots);
+            s->count = 0;
+        }
+    }
+
+    ////////////////////////////////////////
+    //         FUNCTION ITERATORS         //
+    ////////////////////////////////////////
+
+    /*
+     * \brief Takes a function pointer and applies it to all
+     *        elements in the map
+     * \param [in] f The function to apply to each element in the map;
+     *               should return true on success, false on failure
+     * \return number of successful returns from f
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const
+    {
+        size_t numSuccess = 0;
+
+        for (auto& s : m_shards) {
+            acl::shared_lock lock(s->mutex);
+            for (auto& slot : s->slots) {
+                if (slot.used && f(slot.key, slot.value)) {
+                    numSuccess++;
+                }
+            }
+        }
+        return numSuccess;
+    }
+
+    /*
+     * \brief Takes a function pointer and applies it to all
+     *        elements in the map
+     * \param [in] f The function to apply to each element in the map;
+     *               should return true on success, false on failure
+     * \return number of successful returns from f
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            for_each(std::function<bool(const Key& k, Value& v)> f)
+    {
+        size_t numSuccess = 0;
+
+        for (auto& s : m_shards) {
+            std::lock_guard<acl::shared_mutex> lock(s->mutex);
+            for (auto& slot : s->slots) {
+                if (slot.used && f(slot.key, slot.value)) {
+                    numSuccess++;
+                }
+            }
+        }
+        return numSuccess;
+    }
+
+    /*
+     * \brief Iterates through the map and deletes each element that
+     *        meets some condition
+     * \param [in] f Function that takes Key, Value pair and returns
+     *        a boolean, applied to each element; If the function
+     *        returns true on an element, the element is deleted
+     * \return the number of entries deleted
+     */
+    template<typename Key, typename Value, typename Hash> size_t TSHashMap<Key, Value, Hash>::
+            delete_if(std::function<bool(const Key& k, Value& v)> f)
+    {
+        size_t numErased = 0;
+
+        for (auto& s : m_shards) {
+            std::lock_guard<acl::shared_mutex> lock(s->mutex);
+
+            // Backward shifting moves later members of a probe run into the
+            // slot just erased, so only advance when nothing was erased.  The
+            // walk starts after an empty slot (the load factor guarantees one)
+            // so no run wraps from the end of the walk back to its start,
+            // which would shift entries already visited into the hole.
+            size_t mask = s->slots.size() - 1;
+            size_t start = 0;
+            while (start < s->slots.size() && s->slots[start].used) {
+                start++;
+            }
+
+            for (size_t n = 1; n <= s->slots.size(); ) {
+                size_t i = (start + n) & mask;
+                if (s->slots[i].used && f(s->slots[i].key, s->slots[i].value)) {
+                    erase_slot(*s, i);
+                    numErased++;
+                } else {
+                    n++;
+                }
+            }
+        }
+        return numErased;
+    }
+}
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <mutex>
@@ -31,60 +32,149 @@ namespace acl
 
     /*
      * \brief Threadsafe wrapper for standard library ordered map class
+     *
+     * The comparator is a template parameter so key comparisons can be
+     * inlined.  Ordered queries (lower_bound, findInfimum) follow its order,
+     * so with std::greater the infimum of k is the smallest key >= k.
+     *
+     * find, lower_bound and findInfimum return copies of the value.  read
+     * and the visit functions give access to the stored entry instead, for
+     * maps of large values.
+     *
+     * Callbacks run with the map locked and must not call back into the
+     * same map; shared locks are not recursive.
      */
-    template<typename Key, typename Value> class TSMap
+    template<typename Key, typename Value, typename Compare = std::less<Key>> class TSMap
     {
         protected:
-            std::map<Key, Value, std::function<bool(Key,Key)>> m_map;     //!< Map of objects
+            typedef std::map<Key, Value, Compare> MapType;
+            std::map<Key, Value, Compare> m_map;     //!< Map of objects
             mutable shared_mutex m_mutex;
+
+            typename MapType::const_iterator infimum(const Key& k) const;
     
         public:
-            TSMap();
+            /*
+             * \brief Read-only handle to one entry that keeps the map shared
+             *        locked until it is released or destroyed
+             *
+             * Writers block while any ReadGuard is held, so keep guards short
+             * lived and release them on the thread that created them.
+             */
+            class ReadGuard
+            {
+                public:
+                    ReadGuard() : m_mutex(nullptr), m_entry(nullptr) {}
+                    ReadGuard(const ReadGuard&) = delete;
+                    ReadGuard& operator=(const ReadGuard&) = delete;
+                    ReadGuard(ReadGuard&& other) : m_mutex(other.m_mutex), m_entry(other.m_entry)
+                    {
+                        other.m_mutex = nullptr;
+                        other.m_entry = nullptr;
+                    }
+                    ReadGuard& operator=(ReadGuard&& other)
+                    {
+                        if (this != &other) {
+                            release();
+                            std::swap(m_mutex, other.m_mutex);
+                            std::swap(m_entry, other.m_entry);
+                        }
+                        return *this;
+                    }
+                    ~ReadGuard() { release(); }
+
+                    explicit operator bool() const { return m_entry != nullptr; }   //!< True if an entry was found
+                    const Key& key() const { return m_entry->first; }
+                    const Value& operator*() const { return m_entry->second; }
+                    const Value* operator->() const { return &m_entry->second; }
+
+                    /*
+                     * \brief Drops the lock early. The guard is empty afterwards
+                     */
+                    void release()
+                    {
+                        if (m_mutex) {
+                            m_mutex->unlock_shared();
+                        }
+                        m_mutex = nullptr;
+                        m_entry = nullptr;
+                    }
+
+                private:
+                    friend class TSMap;
+                    ReadGuard(shared_mutex* m, const std::pair<const Key, Value>* entry)
+                        : m_mutex(m), m_entry(entry) {}
+
+                    shared_mutex*                       m_mutex;    //!< Shared locked mutex, if any
+                    const std::pair<const Key, Value>*  m_entry;    //!< Entry read through this guard
+            };
+
+            TSMap(const Compare& comp = Compare());
             virtual ~TSMap();
 
             // read functions
-            std::pair<Value, bool>  find(Key k) const;
-            std::pair<Value, bool>  lower_bound(Key k) const;
-            std::pair<std::pair<Key,Value>, bool> lower_bound_key(Key k) const;
-            std::pair<Value, bool>  findInfimum(Key k) const;
-            std::pair<std::pair<Key,Value>, bool>  findInfimum_key(Key k) const;
+            std::pair<Value, bool>  find(const Key& k) const;
+            std::pair<Value, bool>  lower_bound(const Key& k) const;
+            std::pair<std::pair<Key,Value>, bool> lower_bound_key(const Key& k) const;
+            std::pair<Value, bool>  findInfimum(const Key& k) const;
+            std::pair<std::pair<Key,Value>, bool>  findInfimum_key(const Key& k) const;
+            ReadGuard               read(const Key& k) const;
+            template<typename F>
+            bool                    visit(const Key& k, F f) const;
+            template<typename F>
+            bool                    visit_lower_bound(const Key& k, F f) const;
+            template<typename F>
+            bool                    visit_infimum(const Key& k, F f) const;
             size_t                  size() const;
             bool                    empty() const;
             std::vector<Key>        getKeyList() const;
     
             // write functions
-            bool                    emplace(Key k, Value v, bool force = false);
+            bool                    emplace(const Key& k, Value v, bool force = false);
             template<typename... Args>
-            bool                    createInPlace(Key k, Args... args);
-            std::pair<Value,bool>   replace(Key k, Value v, bool force = true);
-            bool                    erase(Key k, std::function<bool(Key,Value&)> f = nullptr);
-            std::pair<Value, bool>  remove(Key k);
+            bool                    createInPlace(const Key& k, Args... args);
+            std::pair<Value,bool>   replace(const Key& k, Value v, bool force = true);
+            bool                    erase(const Key& k, std::function<bool(const Key&,Value&)> f = nullptr);
+            std::pair<Value, bool>  remove(const Key& k);
 
-            bool                    perform(Key k, std::function<bool(Key,Value&)> f = nullptr);
-            bool                    perform_ro(Key k, std::function<bool(Key,const Value&)> f = nullptr) const;
+            bool                    perform(const Key& k, std::function<bool(const Key&,Value&)> f = nullptr);
+            bool                    perform_ro(const Key& k, std::function<bool(const Key&,const Value&)> f = nullptr) const;
             void                    clear();
 
             // function iterators
-            size_t for_each_ro(std::function<bool(Key k, const Value& v)> f) const;
-            size_t for_each(std::function<bool(Key k, Value& v)> f);
-            size_t delete_if(std::function<bool(Key k, Value& v)> f);
+            size_t for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const;
+            size_t for_each(std::function<bool(const Key& k, Value& v)> f);
+            size_t delete_if(std::function<bool(const Key& k, Value& v)> f);
+
+            void   set_lock_name(const std::string& name);
     };
 
     /**
-     * @brief Constructor. Explicitly defines the comparison operator for use by the map.
+     * @brief Constructor
+     * @param comp The comparison object used to order keys
      **/
-    template<typename Key, typename Value> TSMap<Key, Value>::TSMap()
-        : m_map([](Key k1, Key k2)->bool { return k1 < k2; })
+    template<typename Key, typename Value, typename Compare> TSMap<Key, Value, Compare>::TSMap(const Compare& comp)
+        : m_map(comp)
     { }
 
     /**
      * @brief Destructor. Clears the map
      */
-    template<typename Key, typename Value> TSMap<Key, Value>::~TSMap()
+    template<typename Key, typename Value, typename Compare> TSMap<Key, Value, Compare>::~TSMap()
     {
         clear();
     }
 
+    /**
+     * @brief Sets the name the map's lock is listed under in the
+     *        LockRegistry.  Does nothing unless built with DEBUG_CACHE.
+     */
+    template<typename Key, typename Value, typename Compare> void TSMap<Key, Value, Compare>::
+            set_lock_name(const std::string& name)
+    {
+        m_mutex.set_lock_name(name);
+    }
+
     ////////////////////////////////////////
     //            READ METHODS            //
     ////////////////////////////////////////
@@ -95,8 +185,8 @@ namespace acl
      *
      * \return The value correspoding to Key k
      */
-    template<typename Key, typename Value> std::pair<Value, bool> TSMap<Key, Value>::
-            find(Key k) const
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> TSMap<Key, Value, Compare>::
+            find(const Key& k) const
     {
         acl::shared_lock lock(m_mutex);
         auto it = m_map.find(k);
@@ -114,8 +204,8 @@ namespace acl
      * \return The value with the smallest key greater than or equal t
      * correspoding to Key k
      */
-    template<typename Key, typename Value> std::pair<Value, bool> TSMap<Key, Value>::
-            lower_bound(Key k) const
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> TSMap<Key, Value, Compare>::
+            lower_bound(const Key& k) const
     {
         acl::shared_lock lock(m_mutex);
         auto it = m_map.lower_bound(k);
@@ -133,9 +223,9 @@ namespace acl
      * \return The value with the smallest key greater than or equal t
      * correspoding to Key k; also returns the Key of this Value
      */
-    template<typename Key, typename Value> 
-            std::pair<std::pair<Key, Value>, bool> TSMap<Key, Value>::
-            lower_bound_key(Key k) const
+    template<typename Key, typename Value, typename Compare> 
+            std::pair<std::pair<Key, Value>, bool> TSMap<Key, Value, Compare>::
+            lower_bound_key(const Key& k) const
     {
         acl::shared_lock lock(m_mutex);
         auto it = m_map.lower_bound(k);
@@ -154,24 +244,16 @@ namespace acl
      *         Value, if found. The bool is true if a Value is found, 
      *         else false if none is found
      **/
-    template<typename Key,typename Value> 
-            std::pair<Value,bool> TSMap<Key,Value>::findInfimum(Key k) const
+    template<typename Key, typename Value, typename Compare> 
+            std::pair<Value,bool> TSMap<Key, Value, Compare>::findInfimum(const Key& k) const
     {
         acl::shared_lock lock(m_mutex);
-        auto it = m_map.lower_bound(k);
+        auto it = infimum(k);
 
-        // If the iterator has the same key, return its value
-        if( it != m_map.end() && it->first == k ){
-            return std::make_pair(it->second, true);
-        } 
-        // Else if the iterator is the first element, then either the map 
-        // is empty or the first element is greater than the search key
-        else if( it == m_map.begin() ){
+        if( it == m_map.end() ){
             return std::make_pair(Value{}, false);
-        } else{ // else, we decrement the iterator and return its value
-            it--;
-            return std::make_pair(it->second, true);
         }
+        return std::make_pair(it->second, true);
     }
 
     /**
@@ -182,30 +264,131 @@ namespace acl
      *         Value, if found. The bool is true if a Value is found, 
      *         else false if none is found
      **/
-    template<typename Key,typename Value> 
-            std::pair<std::pair<Key,Value>,bool> TSMap<Key,Value>::findInfimum_key(Key k) const
+    template<typename Key, typename Value, typename Compare> 
+            std::pair<std::pair<Key,Value>,bool> TSMap<Key, Value, Compare>::findInfimum_key(const Key& k) const
     {
         acl::shared_lock lock(m_mutex);
+        auto it = infimum(k);
+
+        if( it == m_map.end() ){
+            return std::make_pair(std::make_pair(Key{},Value{}), false);
+        }
+        return std::make_pair(std::make_pair(it->first,it->second), true);
+    }
+
+    /**
+     * \brief Finds the entry with the greatest key less than or equal to k.
+     *        Assumes m_mutex is held.
+     * \return Iterator to the entry, or m_map.end() if there is none
+     **/
+    template<typename Key, typename Value, typename Compare>
+            typename TSMap<Key, Value, Compare>::MapType::const_iterator TSMap<Key, Value, Compare>::
+            infimum(const Key& k) const
+    {
         auto it = m_map.lower_bound(k);
 
-        // If the iterator has the same key, return its value
-        if( it != m_map.end() && it->first == k ){
-            return std::make_pair(std::make_pair(it->first,it->second), true);
+        // If the iterator has the same key, return it
+        if( it != m_map.end() && !m_map.key_comp()(k, it->first) ){
+            return it;
         } 
         // Else if the iterator is the first element, then either the map 
         // is empty or the first element is greater than the search key
         else if( it == m_map.begin() ){
-            return std::make_pair(std::make_pair(Key{},Value{}), false);
-        } else{ // else, we decrement the iterator and return its value
-            it--;
-            return std::make_pair(std::make_pair(it->first,it->second), true);
+            return m_map.end();
+        }
+        // else, the previous element is the infimum
+        return --it;
+    }
+
+    ////////////////////////////////////////
+    //         ZERO-COPY READERS          //
+    ////////////////////////////////////////
+
+    /**
+     * \brief Looks up a key and returns a guard referencing its entry
+     *        without copying the key or value.  The map stays shared locked
+     *        while the guard is held.
+     * \param k The Key to search for
+     * \return A guard that converts to true if the key was found.  An empty
+     *         guard holds no lock.
+     **/
+    template<typename Key, typename Value, typename Compare>
+            typename TSMap<Key, Value, Compare>::ReadGuard TSMap<Key, Value, Compare>::
+            read(const Key& k) const
+    {
+        m_mutex.lock_shared();
+        auto it = m_map.find(k);
+
+        if (it == m_map.end()) {
+            m_mutex.unlock_shared();
+            return ReadGuard();
+        }
+        return ReadGuard(&m_mutex, &*it);
+    }
+
+    /**
+     * \brief Calls f(const Key&, const Value&) on the entry for k under the
+     *        shared lock.  Nothing is copied and f is not type-erased, so this
+     *        is the cheapest way to read part of a large value.
+     * \param k The Key to search for
+     * \param f Callable invoked on the entry; its return value is ignored
+     * \return true if the key was found and f was called
+     **/
+    template<typename Key, typename Value, typename Compare>
+    template<typename F> bool TSMap<Key, Value, Compare>::
+            visit(const Key& k, F f) const
+    {
+        acl::shared_lock lock(m_mutex);
+        auto it = m_map.find(k);
+
+        if (it == m_map.end()) {
+            return false;
+        }
+        f(it->first, it->second);
+        return true;
+    }
+
+    /**
+     * \brief Like visit, on the first entry with a key not less than k
+     * \return true if such an entry exists and f was called
+     **/
+    template<typename Key, typename Value, typename Compare>
+    template<typename F> bool TSMap<Key, Value, Compare>::
+            visit_lower_bound(const Key& k, F f) const
+    {
+        acl::shared_lock lock(m_mutex);
+        auto it = m_map.lower_bound(k);
+
+        if (it == m_map.end()) {
+            return false;
         }
+        f(it->first, it->second);
+        return true;
+    }
+
+    /**
+     * \brief Like visit, on the entry with the greatest key less than or
+     *        equal to k
+     * \return true if such an entry exists and f was called
+     **/
+    template<typename Key, typename Value, typename Compare>
+    template<typename F> bool TSMap<Key, Value, Compare>::
+            visit_infimum(const Key& k, F f) const
+    {
+        acl::shared_lock lock(m_mutex);
+        auto it = infimum(k);
+
+        if (it == m_map.end()) {
+            return false;
+        }
+        f(it->first, it->second);
+        return true;
     }
 
     /*
      * \brief returns the number of entries in the map
      */
-    template<typename Key, typename Value> size_t TSMap<Key, Value>::
+    template<typename Key, typename Value, typename Compare> size_t TSMap<Key, Value, Compare>::
             size() const
     {
         acl::shared_lock lock(m_mutex);
@@ -216,14 +399,14 @@ namespace acl
     /*
      * \brief checks if the map is empty
      */
-    template<typename Key, typename Value> bool TSMap<Key, Value>::
+    template<typename Key, typename Value, typename Compare> bool TSMap<Key, Value, Compare>::
             empty() const
     {
         acl::shared_lock lock(m_mutex);
         return m_map.empty();
     }
 
-    template<typename Key, typename Value> std::vector<Key> TSMap<Key, Value>::
+    template<typename Key, typename Value, typename Compare> std::vector<Key> TSMap<Key, Value, Compare>::
             getKeyList() const
     {
         std::vector<Key> keyList;
@@ -247,17 +430,24 @@ namespace acl
      *
      * return true if no element previously existed, false if one did
      */
-    template<typename Key, typename Value> bool TSMap<Key, Value>::
-            emplace(Key k, Value v, bool force)
+    template<typename Key, typename Value, typename Compare> bool TSMap<Key, Value, Compare>::
+            emplace(const Key& k, Value v, bool force)
     {
-        std::lock_guard<acl::shared_mutex> lock(m_mutex);
+        // Only block readers once we know the map will change
+        acl::upgrade_lock lock(m_mutex);
+        auto it = m_map.find(k);
 
-        if (!force && m_map.find(k) != m_map.end()) {
-            return false;
+        if (it != m_map.end()) {
+            if (!force) {
+                return false;
+            }
+            lock.upgrade();
+            it->second = std::move(v);
+            return true;
         }
-        m_map.erase(k);
 
-        return m_map.emplace(k, v).second;
+        lock.upgrade();
+        return m_map.emplace(k, std::move(v)).second;
     }
 
     /*
@@ -267,9 +457,9 @@ namespace acl
      *
      * return true if the value was successfully created
      */
-    template<typename Key, typename Value>
-    template<typename... Args> bool TSMap<Key,Value>::
-        createInPlace(Key k, Args... args)
+    template<typename Key, typename Value, typename Compare>
+    template<typename... Args> bool TSMap<Key, Value, Compare>::
+        createInPlace(const Key& k, Args... args)
     {
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
         auto ret = m_map.emplace(std::piecewise_construct,
@@ -290,20 +480,25 @@ namespace acl
      * note: if nothing was in this location previously, the return Value will
      * be the value that was passed in. 
      */
-    template<typename Key, typename Value> std::pair<Value,bool> TSMap<Key, Value>::
-            replace(Key k, Value v, bool force)
+    template<typename Key, typename Value, typename Compare> std::pair<Value,bool> TSMap<Key, Value, Compare>::
+            replace(const Key& k, Value v, bool force)
     {
-        std::lock_guard<acl::shared_mutex> lock(m_mutex);
-        Value newVal = v;
-        auto it = m_map.emplace(k, newVal);
+        // Only block readers once we know the map will change
+        acl::upgrade_lock lock(m_mutex);
+        auto it = m_map.find(k);
 
-        if (!it.second) {
-            newVal = it.first->second;
+        if (it != m_map.end()) {
+            std::pair<Value,bool> ret(it->second, false);
             if (force) {
-                m_map[k] = v;
+                lock.upgrade();
+                it->second = std::move(v);
             }
+            return ret;
         }
-        return std::pair<Value,bool>(newVal, it.second);
+
+        lock.upgrade();
+        m_map.emplace(k, v);
+        return std::pair<Value,bool>(v, true);
     }
 
     /*
@@ -314,8 +509,8 @@ namespace acl
      *
      * \return true if the element was erased, false otherwise
      */
-    template<typename Key, typename Value> bool TSMap<Key, Value>::
-            erase(Key k, std::function<bool(Key,Value&)> f)
+    template<typename Key, typename Value, typename Compare> bool TSMap<Key, Value, Compare>::
+            erase(const Key& k, std::function<bool(const Key&,Value&)> f)
     {
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
         auto it = m_map.find(k);
@@ -338,16 +533,16 @@ namespace acl
  * \param[in] k The key to find, return, and remove
  * \return A pair of the value and a bool to indicate success
  **/
-    template<typename Key, typename Value> std::pair<Value, bool> TSMap<Key, Value>::
-            remove(Key k)
+    template<typename Key, typename Value, typename Compare> std::pair<Value, bool> TSMap<Key, Value, Compare>::
+            remove(const Key& k)
     {
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
         auto it = m_map.find(k);
 
         if (it != m_map.end()) {
-            // Make pair before erasing
-            auto ret = std::make_pair(it->second, true);
-            m_map.erase(k);
+            // Make pair before erasing; the entry is going away so move from it
+            auto ret = std::make_pair(std::move(it->second), true);
+            m_map.erase(it);
             return ret;
         }
         return std::make_pair(Value{}, false);
@@ -360,8 +555,8 @@ namespace acl
      *
      * \return The value returned by the fucntion
      */
-    template<typename Key, typename Value> bool TSMap<Key, Value>::
-    perform(Key k, std::function<bool(Key,Value&)> f)
+    template<typename Key, typename Value, typename Compare> bool TSMap<Key, Value, Compare>::
+    perform(const Key& k, std::function<bool(const Key&,Value&)> f)
     {
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
         auto it = m_map.find(k);
@@ -380,8 +575,8 @@ namespace acl
      *
      * \return The value returned by the fucntion
      */
-    template<typename Key, typename Value> bool TSMap<Key, Value>::
-    perform_ro(Key k, std::function<bool(Key,const Value&)> f) const
+    template<typename Key, typename Value, typename Compare> bool TSMap<Key, Value, Compare>::
+    perform_ro(const Key& k, std::function<bool(const Key&,const Value&)> f) const
     {
         acl::shared_lock lock(m_mutex);
         auto it = m_map.find( k );
@@ -396,7 +591,7 @@ namespace acl
     /*
      * \brief Clears all entries from the map
      */
-    template<typename Key, typename Value> void TSMap<Key, Value>::
+    template<typename Key, typename Value, typename Compare> void TSMap<Key, Value, Compare>::
             clear()
     {
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
@@ -415,8 +610,8 @@ namespace acl
      *               should return true on success, false on failure
      * \return number of successful returns from f
      */
-    template<typename Key, typename Value> size_t TSMap<Key, Value>::
-            for_each_ro(std::function<bool(Key k, const Value& v)> f) const
+    template<typename Key, typename Value, typename Compare> size_t TSMap<Key, Value, Compare>::
+            for_each_ro(std::function<bool(const Key& k, const Value& v)> f) const
     {
         size_t numSuccess = 0;
         acl::shared_lock lock(m_mutex);
@@ -436,8 +631,8 @@ namespace acl
      *               should return true on success, false on failure
      * \return number of successful returns from f
      */
-    template<typename Key, typename Value> size_t TSMap<Key, Value>::
-            for_each(std::function<bool(Key k, Value& v)> f)
+    template<typename Key, typename Value, typename Compare> size_t TSMap<Key, Value, Compare>::
+            for_each(std::function<bool(const Key& k, Value& v)> f)
     {
         size_t numSuccess = 0;
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
@@ -458,8 +653,8 @@ namespace acl
      *        returns true on an element, the element is deleted
      * \return the number of entries deleted
      */
-    template<typename Key, typename Value> size_t TSMap<Key, Value>::
-            delete_if(std::function<bool(Key k, Value& v)> f)
+    template<typename Key, typename Value, typename Compare> size_t TSMap<Key, Value, Compare>::
+            delete_if(std::function<bool(const Key& k, Value& v)> f)
     {
         size_t numErased = 0;
         std::lock_guard<acl::shared_mutex> lock(m_mutex);
@@ -0,0 +1,203 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file TSPriorityQueue.tcc
+ **/
+
+#pragma once
+
+#include "TSQueue.tcc"
+#include <deque>
+#include <vector>
+#include <utility>
+
+namespace acl
+{
+
+/**
+* @brief A thread-safe queue with a fixed number of priority bands
+*
+* Behaves like TSQueue (same locking, blocking and max size rules), but every
+* element is tagged with a priority between 0 and get_num_priorities() - 1.
+* dequeue() always returns the oldest element of the highest non-empty band,
+* so urgent data overtakes bulk data without starving order within a band.
+*
+* The inherited enqueue() overloads use priority 0.  push() puts data in
+* front of everything else, as with TSQueue.
+*
+* @tparam T The type of data to be contained in the queue
+*/
+template <typename T> class TSPriorityQueue: public TSQueue<T>
+{
+private:
+    typedef TSQueue<T> Q;
+
+public:
+    TSPriorityQueue(unsigned numPriorities = 8);                          //<! Constructor
+    virtual bool enqueue(const T& data, bool force = false) { return Q::enqueue(data, force); }
+    virtual bool enqueue(T&& data, bool force = false) { return Q::enqueue(std::move(data), force); }
+    virtual bool enqueue(const T& data, int priority, bool force = false); //<! Add data to the tail of a band
+    virtual bool enqueue(T&& data, int priority, bool force = false);      //<! Move data to the tail of a band
+    unsigned get_num_priorities() const;                                   //<! Returns the number of bands
+
+protected:
+    std::vector<std::deque<T>> m_bands;                   //<! One FIFO per priority, highest last
+
+    int clamp(int priority) const;                        //<! Limits priority to a valid band
+    int top_band() const;                                 //<! Highest non-empty band.  Assumes m is held
+    virtual void store_back(const T& data);
+    virtual void store_back(T&& data);
+    virtual void store_front(const T& data);
+    virtual void store_front(T&& data);
+    virtual void take_front(T& data);
+    virtual void read_front(T& data);
+    virtual void clear_storage();
+};
+
+/**
+* @brief Constructor
+*
+* @param numPriorities The number of priority bands.  At least one is created.
+**/
+template<typename T> TSPriorityQueue<T>::TSPriorityQueue(unsigned numPriorities)
+    : m_bands(numPriorities ? numPriorities : 1)
+{}
+
+/**
+* @brief Adds data to the tail of the given priority band
+*
+* @param data The data to add
+* @param priority Band to add the data to.  Higher values are dequeued
+*        first; values outside the valid range are clamped.
+* @param force True will push data even if the length is greater than max_size
+*/
+template<typename T> bool TSPriorityQueue<T>::enqueue(const T& data, int priority, bool force)
+{
+    return enqueue(T(data), priority, force);
+}
+
+/**
+* @brief Moves data to the tail of the given priority band
+*
+* @param data The data to add
+* @param priority Band to add the data to.  Higher values are dequeued
+*        first; values outside the valid range are clamped.
+* @param force True will push data even if the length is greater than max_size
+*/
+template<typename T> bool TSPriorityQueue<T>::enqueue(T&& data, int priority, bool force)
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+
+    if (!force && Q::length >= Q::max_size) {
+        return false;
+    }
+
+    m_bands[clamp(priority)].push_back(std::move(data));
+    Q::length++;
+    Q::enqueue_cv.notify_one();
+    return true;
+}
+
+/**
+* @brief Returns the number of priority bands
+*/
+template<typename T> unsigned TSPriorityQueue<T>::get_num_priorities() const
+{
+    return m_bands.size();
+}
+
+/**
+* @brief Limits priority to [0, get_num_priorities() - 1]
+*/
+template<typename T> int TSPriorityQueue<T>::clamp(int priority) const
+{
+    if (priority < 0) {
+        return 0;
+    }
+    return priority < (int)m_bands.size() ? priority : (int)m_bands.size() - 1;
+}
+
+/**
+* @brief Returns the highest band holding data.  Assumes m is held and the
+*        queue is not empty.
+*/
+template<typename T> int TSPriorityQueue<T>::top_band() const
+{
+    int band = m_bands.size() - 1;
+    while (band > 0 && m_bands[band].empty()) {
+        band--;
+    }
+    return band;
+}
+
+/**
+* @brief Stores data at the tail of the lowest band.  Assumes m is held.
+*/
+template<typename T> void TSPriorityQueue<T>::store_back(const T& data)
+{
+    m_bands.front().push_back(data);
+    Q::length++;
+}
+
+/**
+* @brief Moves data to the tail of the lowest band.  Assumes m is held.
+*/
+template<typename T> void TSPriorityQueue<T>::store_back(T&& data)
+{
+    m_bands.front().push_back(std::move(data));
+    Q::length++;
+}
+
+/**
+* @brief Stores data ahead of everything in the highest band.  Assumes m is held.
+*/
+template<typename T> void TSPriorityQueue<T>::store_front(const T& data)
+{
+    m_bands.back().push_front(data);
+    Q::length++;
+}
+
+/**
+* @brief Moves data ahead of everything in the highest band.  Assumes m is held.
+*/
+template<typename T> void TSPriorityQueue<T>::store_front(T&& data)
+{
+    m_bands.back().push_front(std::move(data));
+    Q::length++;
+}
+
+/**
+* @brief Moves out the oldest element of the highest non-empty band.
+*        Assumes m is held and the queue is not empty.
+*/
+template<typename T> void TSPriorityQueue<T>::take_front(T& data)
+{
+    std::deque<T>& band = m_bands[top_band()];
+    data = std::move(band.front());
+    band.pop_front();
+    Q::length--;
+}
+
+/**
+* @brief Copies the element take_front() would return.  Assumes m is held
+*        and the queue is not empty.
+*/
+template<typename T> void TSPriorityQueue<T>::read_front(T& data)
+{
+    data = m_bands[top_band()].front();
+}
+
+/**
+* @brief Empties every band.  Assumes m is held.
+*/
+template<typename T> void TSPriorityQueue<T>::clear_storage()
+{
+    for (auto& band : m_bands) {
+        band.clear();
+    }
+    Q::length = 0;
+}
+}
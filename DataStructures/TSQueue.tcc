@@ -15,6 +15,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <memory>
+#include <utility>
 #include <cstdio>
 #include <ctime>
 #include <random>
@@ -22,6 +23,12 @@
 #include <assert.h>
 #include "Timer.h"
 #include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef DEBUG_CACHE
+#include "LockStats.h"
+#endif
 
 #pragma once
 
@@ -30,6 +37,12 @@
 namespace acl
 {
 
+/**
+* @brief Tag type for blocking queue calls that should wait with no timeout
+*/
+struct wait_forever_t {};
+static const wait_forever_t wait_forever = {};   //<! Pass instead of a timeout to wait indefinitely
+
 /**
 * @brief A thread-safe queue for APL commands between threads
 *
@@ -40,32 +53,112 @@ namespace acl
 */
 template <typename T> class TSQueue
 {
+public:
+    // With DEBUG_CACHE every queue lock records contention in the LockRegistry
+#ifdef DEBUG_CACHE
+    typedef AclMutex mutex_type;
+    typedef std::condition_variable_any cv_type;
+#else
+    typedef std::mutex mutex_type;
+    typedef std::condition_variable cv_type;
+#endif
+
 protected:
-    std::recursive_mutex m;                 //<! The mutex that will be used for accessing the queue
-    std::condition_variable_any enqueue_cv; //<! The condition variable which waits on blocking dequeue
-    std::condition_variable_any dequeue_cv; //<! The condition variable which waits on blocking dequeue
+    mutex_type m;                           //<! The mutex that will be used for accessing the queue
+    cv_type enqueue_cv;                     //<! The condition variable which waits on blocking dequeue
+    cv_type dequeue_cv;                     //<! The condition variable which waits on blocking dequeue
     std::atomic_size_t length;              //<! The length of the queue
     struct QNode;                           //<! A simple linked list node
     std::shared_ptr<QNode> head;            //<! The head of the queue
     std::weak_ptr<QNode> tail;              //<! The tail of the queue
     size_t max_size = DEFAULT_MAX_SIZE;     //<! Maximum size of queue
+    bool waits_cancelled = false;           //<! Set by cancel_waits() to release blocked consumers
 
+    // Storage primitives.  These assume m is held and keep length up to date,
+    // so derived classes can swap out the linked list without touching the
+    // locking and blocking logic of the public interface.  m is not
+    // recursive, so none of these may call back into the public interface.
     virtual void enqueue(std::shared_ptr<QNode> node);   //<! Adds a QNode to the tail of the queue
-
+    virtual void store_back(const T& data);               //<! Stores data behind the tail
+    virtual void store_back(T&& data);                    //<! Moves data behind the tail
+    virtual void store_front(const T& data);              //<! Stores data ahead of the head
+    virtual void store_front(T&& data);                   //<! Moves data ahead of the head
+    virtual void take_front(T& data);                     //<! Moves the head out into data
+    virtual void read_front(T& data);                     //<! Copies the head into data
+    virtual void clear_storage();                         //<! Releases all stored data
+
+    // Blocking helpers shared by every timeout flavor.  Wait is a
+    // std::chrono duration, an absolute std::chrono time_point or wait_forever.
+    template<typename Pred, typename Rep, typename Period>
+    static bool wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                        const std::chrono::duration<Rep, Period>& timeout, Pred pred);
+    template<typename Pred, typename Clock, typename Duration>
+    static bool wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                        const std::chrono::time_point<Clock, Duration>& deadline, Pred pred);
+    template<typename Pred>
+    static bool wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                        wait_forever_t, Pred pred);
+    template<typename Wait> bool dequeue_wait(T& data, const Wait& wait);
+    template<typename Wait> bool peek_wait(T& value, const Wait& wait);
+    template<typename Wait> bool empty_wait(const Wait& wait);
+    template<typename OutputIt, typename Wait>
+    size_t dequeue_bulk_wait(OutputIt out, size_t max, const Wait& wait);
 
 public:
     TSQueue();                                            //<! Constructor
     virtual ~TSQueue();                                   //<! Destructor.  Deletes all data in queue
     virtual bool enqueue(const T&, bool force = false);   //<! Add data to the tail of the queue
+    virtual bool enqueue(T&&, bool force = false);        //<! Move data to the tail of the queue
     virtual bool dequeue(T& data, uint16_t timeout = 0);  //<! Remove and return data from the head of the queue
     virtual bool push(T, bool force = false);             //<! Add data to the head of the queue (as a stack)
     virtual bool pop(T& data, uint16_t timeout = 0);      //<! Pop data off the head of the queue (as a stack)
     virtual bool peek(T& value, uint16_t timeout = 0);    //<! Peek at the head of the queue
     virtual size_t size();                                //<! Return the size of the queue
     virtual void delete_all();                            //<! Deletes all nodes in the queue
-    virtual void set_max_size(size_t);                    //<! Sets max size
+    virtual bool set_max_size(size_t);                    //<! Sets max size
     virtual size_t get_max_size();                        //<! Returns max size
     virtual bool wait_until_empty(uint16_t timeout = 0);  //<! Waits until queue is empty
+    virtual void cancel_waits();                          //<! Releases blocked consumers and stops new ones blocking
+    virtual void resume_waits();                          //<! Lets consumers block again after cancel_waits()
+    void set_lock_name(const std::string& name);          //<! Names the lock in LockRegistry dumps (DEBUG_CACHE only)
+
+    // std::chrono timeouts, absolute deadlines and wait_forever
+    template<typename Rep, typename Period>
+    bool dequeue(T& data, const std::chrono::duration<Rep, Period>& timeout) { return dequeue_wait(data, timeout); }
+    template<typename Clock, typename Duration>
+    bool dequeue(T& data, const std::chrono::time_point<Clock, Duration>& deadline) { return dequeue_wait(data, deadline); }
+    bool dequeue(T& data, wait_forever_t) { return dequeue_wait(data, wait_forever); }
+    template<typename Rep, typename Period>
+    bool pop(T& data, const std::chrono::duration<Rep, Period>& timeout) { return dequeue_wait(data, timeout); }
+    template<typename Clock, typename Duration>
+    bool pop(T& data, const std::chrono::time_point<Clock, Duration>& deadline) { return dequeue_wait(data, deadline); }
+    bool pop(T& data, wait_forever_t) { return dequeue_wait(data, wait_forever); }
+    template<typename Rep, typename Period>
+    bool peek(T& value, const std::chrono::duration<Rep, Period>& timeout) { return peek_wait(value, timeout); }
+    template<typename Clock, typename Duration>
+    bool peek(T& value, const std::chrono::time_point<Clock, Duration>& deadline) { return peek_wait(value, deadline); }
+    bool peek(T& value, wait_forever_t) { return peek_wait(value, wait_forever); }
+    template<typename Rep, typename Period>
+    bool wait_until_empty(const std::chrono::duration<Rep, Period>& timeout) { return empty_wait(timeout); }
+    template<typename Clock, typename Duration>
+    bool wait_until_empty(const std::chrono::time_point<Clock, Duration>& deadline) { return empty_wait(deadline); }
+    bool wait_until_empty(wait_forever_t) { return empty_wait(wait_forever); }
+
+    template<typename... Args>
+    bool emplace(Args&&... args);                                                  //<! Construct data at the tail of the queue
+    template<typename InputIt>
+    size_t enqueue_bulk(InputIt first, InputIt last, bool force = false);         //<! Add a range to the tail of the queue
+    template<typename OutputIt>
+    size_t dequeue_bulk(OutputIt out, size_t max, uint16_t timeout = 0);          //<! Remove up to max elements from the head
+    template<typename OutputIt, typename Rep, typename Period>
+    size_t dequeue_bulk(OutputIt out, size_t max, const std::chrono::duration<Rep, Period>& timeout)
+        { return dequeue_bulk_wait(out, max, timeout); }
+    template<typename OutputIt, typename Clock, typename Duration>
+    size_t dequeue_bulk(OutputIt out, size_t max, const std::chrono::time_point<Clock, Duration>& deadline)
+        { return dequeue_bulk_wait(out, max, deadline); }
+    template<typename OutputIt>
+    size_t dequeue_bulk(OutputIt out, size_t max, wait_forever_t)
+        { return dequeue_bulk_wait(out, max, wait_forever); }
 };
 
 //template<class K, class V> struct CacheNode;
@@ -75,9 +168,8 @@ public:
 * @brief Node struct for linked list
 */
 template<typename T> struct TSQueue<T>::QNode {
-    QNode(const T& new_data) {
-        data = new_data;
-    }
+    QNode(const T& new_data): data(new_data) {}
+    QNode(T&& new_data): data(std::move(new_data)) {}
 
     T data;
     std::weak_ptr<QNode> next;   // Node closer to head
@@ -87,7 +179,14 @@ template<typename T> struct TSQueue<T>::QNode {
 /**
 * @brief Constructor
 **/
-template<typename T> TSQueue<T>::TSQueue(): length(0) {}
+template<typename T> TSQueue<T>::TSQueue(): length(0)
+{
+#ifdef DEBUG_CACHE
+    std::ostringstream name;
+    name << "TSQueue@" << this;
+    m.set_name(name.str());
+#endif
+}
 
 /**
 * @brief Destructor.  Deletes all nodes in the queue
@@ -97,26 +196,37 @@ template<typename T> TSQueue<T>::~TSQueue()
     delete_all();
 }
 
+/**
+* @brief Sets the name this queue's lock is listed under in the LockRegistry.
+*        Does nothing unless built with DEBUG_CACHE.
+*/
+template<typename T> void TSQueue<T>::set_lock_name(const std::string& name)
+{
+#ifdef DEBUG_CACHE
+    m.set_name(name);
+#else
+    (void)name;
+#endif
+}
+
 /**
 * @brief Deletes all nodes in the queue including their data
 */
 template<typename T> void TSQueue<T>::delete_all()
 {
-    std::lock_guard<std::recursive_mutex> lock(m);
-    head.reset();
-    length = 0;
+    std::lock_guard<mutex_type> lock(m);
+    clear_storage();
     dequeue_cv.notify_all();
 }
 
 /**
 * @brief Adds a node to the tail of the queue, ignoring size and other checks.
+*        Assumes m is held.
 *
 * @param data The data to be contained in the Node
 */
 template<typename T> void TSQueue<T>::enqueue(std::shared_ptr<QNode> node)
 {
-    std::lock_guard<std::recursive_mutex> lock(m);
-
     if (auto tailPtr = tail.lock()) {
         tailPtr->prev = node;
         node->next = tailPtr;
@@ -136,18 +246,139 @@ template<typename T> void TSQueue<T>::enqueue(std::shared_ptr<QNode> node)
 */
 template<typename T> bool TSQueue<T>::enqueue(const T& data, bool force)
 {
-    std::lock_guard<std::recursive_mutex> lock(m);
+    std::lock_guard<mutex_type> lock(m);
 
     if (!force && length >= max_size) {
         return false;
     }
 
-    std::shared_ptr<QNode> temp = std::shared_ptr<QNode>(new QNode(data));
-    enqueue(temp);      //Recursive mutex allows for multiple locks from the same thread
+    store_back(data);
     enqueue_cv.notify_one();
     return true;
 }
 
+/**
+* @brief Moves data to the tail of the queue without copying it
+*
+* @param data The data to be contained in the Node.  Left moved-from on success.
+* @param force True will push data even if the length is greater than max_size
+*/
+template<typename T> bool TSQueue<T>::enqueue(T&& data, bool force)
+{
+    std::lock_guard<mutex_type> lock(m);
+
+    if (!force && length >= max_size) {
+        return false;
+    }
+
+    store_back(std::move(data));
+    enqueue_cv.notify_one();
+    return true;
+}
+
+/**
+* @brief Constructs data from args and moves it to the tail of the queue.
+*        The element is built before the lock is taken.
+*
+* @param args The arguments to the constructor of T
+* @return false if the queue is at max_size
+*/
+template<typename T>
+template<typename... Args> bool TSQueue<T>::emplace(Args&&... args)
+{
+    return enqueue(T(std::forward<Args>(args)...));
+}
+
+/**
+* @brief Links a new node holding data behind the tail.  Assumes m is held.
+*
+* @param data The data to be contained in the Node
+*/
+template<typename T> void TSQueue<T>::store_back(const T& data)
+{
+    enqueue(std::shared_ptr<QNode>(new QNode(data)));
+}
+
+/**
+* @brief Links a new node holding data behind the tail, moving data into
+*        the node.  Assumes m is held.
+*
+* @param data The data to be contained in the Node
+*/
+template<typename T> void TSQueue<T>::store_back(T&& data)
+{
+    enqueue(std::shared_ptr<QNode>(new QNode(std::move(data))));
+}
+
+/**
+* @brief Links a new node holding data ahead of the head.  Assumes m is held.
+*
+* @param data The data to be contained in the Node
+*/
+template<typename T> void TSQueue<T>::store_front(const T& data)
+{
+    store_front(T(data));
+}
+
+/**
+* @brief Links a new node holding data ahead of the head, moving data into
+*        the node.  Assumes m is held.
+*
+* @param data The data to be contained in the Node
+*/
+template<typename T> void TSQueue<T>::store_front(T&& data)
+{
+    std::shared_ptr<QNode> temp = std::shared_ptr<QNode>(new QNode(std::move(data)));
+
+    if (head) {
+        head->next = temp;
+        temp->prev = head;
+    } else {
+        tail = temp;
+    }
+
+    head = temp;
+    length++;
+}
+
+/**
+* @brief Unlinks the head node and moves its data out.  Assumes m is held
+*        and the queue is not empty.
+*
+* @param data Receives the data contained in the head
+*/
+template<typename T> void TSQueue<T>::take_front(T& data)
+{
+    data = std::move(head->data);
+    head = head->prev;
+    length--;
+}
+
+/**
+* @brief Copies the data in the head node.  Assumes m is held and the queue
+*        is not empty.
+*
+* @param data Receives the data contained in the head
+*/
+template<typename T> void TSQueue<T>::read_front(T& data)
+{
+    data = head->data;
+}
+
+/**
+* @brief Drops every node in the list.  Assumes m is held.
+*
+* Nodes are released one at a time; resetting head alone frees the chain
+* recursively and overflows the stack on long queues.
+*/
+template<typename T> void TSQueue<T>::clear_storage()
+{
+    while (head) {
+        head = std::move(head->prev);
+    }
+    length = 0;
+}
+
 /**
 * @brief Removes and returns the head of the queue.  Blocks if no data is available
 * @param timeout How long to block before timeout in milliseconds.
@@ -156,15 +387,27 @@ template<typename T> bool TSQueue<T>::enqueue(const T& data, bool force)
 */
 template<typename T> bool TSQueue<T>::dequeue(T& data, uint16_t timeout)
 {
-    std::unique_lock<std::recursive_mutex> lock(m);
+    return dequeue_wait(data, std::chrono::milliseconds(timeout));
+}
+
+/**
+* @brief Shared body of the dequeue() and pop() overloads
+*
+* @param data Receives the data contained in the head
+* @param wait A timeout duration, an absolute deadline or wait_forever
+*
+* @return false on timeout or if cancel_waits() released the call
+*/
+template<typename T>
+template<typename Wait> bool TSQueue<T>::dequeue_wait(T& data, const Wait& wait)
+{
+    std::unique_lock<mutex_type> lock(m);
 
-    if (!enqueue_cv.wait_for(lock, std::chrono::milliseconds(timeout), [this] {return length > 0;})) {
+    if (!wait_on(enqueue_cv, lock, wait, [this] {return length > 0 || waits_cancelled;}) || !length) {
         return false;
     }
 
-    data = head->data;
-    head = head->prev;
-    length--;
+    take_front(data);
 
     if (!length) {
         dequeue_cv.notify_all();
@@ -172,6 +415,151 @@ template<typename T> bool TSQueue<T>::dequeue(T& data, uint16_t timeout)
     return true;
 }
 
+/**
+* @brief Waits on cv until pred is true or timeout has elapsed.  lock must
+*        hold m.
+*
+* @return The final value of pred
+*/
+template<typename T>
+template<typename Pred, typename Rep, typename Period>
+bool TSQueue<T>::wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                         const std::chrono::duration<Rep, Period>& timeout, Pred pred)
+{
+    return cv.wait_for(lock, timeout, pred);
+}
+
+/**
+* @brief Waits on cv until pred is true or deadline has passed.  lock must
+*        hold m.
+*
+* @return The final value of pred
+*/
+template<typename T>
+template<typename Pred, typename Clock, typename Duration>
+bool TSQueue<T>::wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                         const std::chrono::time_point<Clock, Duration>& deadline, Pred pred)
+{
+    return cv.wait_until(lock, deadline, pred);
+}
+
+/**
+* @brief Waits on cv until pred is true, with no timeout.  lock must hold m.
+*
+* @return true
+*/
+template<typename T>
+template<typename Pred>
+bool TSQueue<T>::wait_on(cv_type& cv, std::unique_lock<mutex_type>& lock,
+                         wait_forever_t, Pred pred)
+{
+    cv.wait(lock, pred);
+    return true;
+}
+
+/**
+* @brief Wakes every consumer blocked in dequeue, pop, peek or dequeue_bulk
+*        and makes those calls return immediately when the queue is empty
+*        until resume_waits() is called.  Use this to shut down consumers
+*        that wait with wait_forever.
+*/
+template<typename T> void TSQueue<T>::cancel_waits()
+{
+    std::lock_guard<mutex_type> lock(m);
+    waits_cancelled = true;
+    enqueue_cv.notify_all();
+}
+
+/**
+* @brief Undoes cancel_waits() so consumers block on an empty queue again
+*/
+template<typename T> void TSQueue<T>::resume_waits()
+{
+    std::lock_guard<mutex_type> lock(m);
+    waits_cancelled = false;
+}
+
+/**
+* @brief Adds a range of elements to the tail of the queue under a single
+*        lock acquisition, waking consumers once.
+*
+* @param first Iterator to the first element to add
+* @param last Iterator past the last element to add
+* @param force True will push data even if the length is greater than max_size
+*
+* @return The number of elements added.  Without force, this stops short of
+*         last once the queue reaches max_size.
+*/
+template<typename T>
+template<typename InputIt> size_t TSQueue<T>::enqueue_bulk(InputIt first, InputIt last, bool force)
+{
+    std::lock_guard<mutex_type> lock(m);
+    size_t count = 0;
+
+    for (; first != last && (force || length < max_size); ++first) {
+        store_back(*first);
+        count++;
+    }
+
+    if (count == 1) {
+        enqueue_cv.notify_one();
+    } else if (count > 1) {
+        enqueue_cv.notify_all();
+    }
+    return count;
+}
+
+/**
+* @brief Removes up to max elements from the head of the queue under a single
+*        lock acquisition.  Blocks until at least one element is available.
+*
+* @param out Output iterator that receives the elements in queue order
+* @param max The maximum number of elements to remove
+* @param timeout How long to block before timeout in milliseconds.
+*
+* @return The number of elements removed, 0 on timeout
+*/
+template<typename T>
+template<typename OutputIt> size_t TSQueue<T>::dequeue_bulk(OutputIt out, size_t max, uint16_t timeout)
+{
+    return dequeue_bulk_wait(out, max, std::chrono::milliseconds(timeout));
+}
+
+/**
+* @brief Shared body of the dequeue_bulk() overloads
+*
+* @param out Output iterator that receives the elements in queue order
+* @param max The maximum number of elements to remove
+* @param wait A timeout duration, an absolute deadline or wait_forever
+*
+* @return The number of elements removed, 0 on timeout
+*/
+template<typename T>
+template<typename OutputIt, typename Wait>
+size_t TSQueue<T>::dequeue_bulk_wait(OutputIt out, size_t max, const Wait& wait)
+{
+    std::unique_lock<mutex_type> lock(m);
+
+    if (!max || !wait_on(enqueue_cv, lock, wait, [this] {return length > 0 || waits_cancelled;})) {
+        return 0;
+    }
+
+    size_t count = 0;
+    T data;
+
+    while (count < max && length) {
+        take_front(data);
+        *out = std::move(data);
+        ++out;
+        count++;
+    }
+
+    if (count && !length) {
+        dequeue_cv.notify_all();
+    }
+    return count;
+}
+
 /**
  * @brief Waits until the queue is empty, then returns.
  * NOTE: Due to the uncertain nature of multithreaded programming,
@@ -184,18 +572,24 @@ template<typename T> bool TSQueue<T>::dequeue(T& data, uint16_t timeout)
  */
 template<typename T> bool TSQueue<T>::wait_until_empty(uint16_t timeout)
 {
-    std::unique_lock<std::recursive_mutex> lock(m);
-
     if (!timeout) {
-        dequeue_cv.wait(lock, [this] {return length == 0;});
-        return true;
+        return empty_wait(wait_forever);
     }
+    return empty_wait(std::chrono::milliseconds(timeout));
+}
 
-    if (!dequeue_cv.wait_for(lock, std::chrono::milliseconds(timeout),
-                [this] {return length == 0;})) {
-        return false;
-    }
-    return true;
+/**
+* @brief Shared body of the wait_until_empty() overloads
+*
+* @param wait A timeout duration, an absolute deadline or wait_forever
+*
+* @return true if queue got to 0, false if timeout occured
+*/
+template<typename T>
+template<typename Wait> bool TSQueue<T>::empty_wait(const Wait& wait)
+{
+    std::unique_lock<mutex_type> lock(m);
+    return wait_on(dequeue_cv, lock, wait, [this] {return length == 0;});
 }
 
 /**
@@ -206,23 +600,13 @@ template<typename T> bool TSQueue<T>::wait_until_empty(uint16_t timeout)
 */
 template<typename T> bool TSQueue<T>::push(T data, bool force)
 {
-    std::unique_lock<std::recursive_mutex> lock(m);
+    std::unique_lock<mutex_type> lock(m);
 
     if (!force && length >= max_size) {
         return false;
     }
 
-    std::shared_ptr<QNode> temp = std::shared_ptr<QNode>(new QNode(data));
-
-    if (head) {
-        head->next = temp;
-        temp->prev = head;
-    } else {
-        tail = temp;
-    }
-
-    head = temp;
-    length++;
+    store_front(std::move(data));
     enqueue_cv.notify_one();
     return true;
 }
@@ -246,13 +630,27 @@ template<typename T> bool TSQueue<T>::pop( T& data, uint16_t timeout)
 */
 template<typename T> bool TSQueue<T>::peek(T& value, uint16_t timeout)
 {
-    std::unique_lock<std::recursive_mutex> lock(m);
+    return peek_wait(value, std::chrono::milliseconds(timeout));
+}
+
+/**
+* @brief Shared body of the peek() overloads
+*
+* @param value Receives a copy of the head
+* @param wait A timeout duration, an absolute deadline or wait_forever
+*
+* @return false on timeout or if cancel_waits() released the call
+*/
+template<typename T>
+template<typename Wait> bool TSQueue<T>::peek_wait(T& value, const Wait& wait)
+{
+    std::unique_lock<mutex_type> lock(m);
 
-    if (!enqueue_cv.wait_for(lock, std::chrono::milliseconds(timeout), [this] {return length > 0;})) {
+    if (!wait_on(enqueue_cv, lock, wait, [this] {return length > 0 || waits_cancelled;}) || !length) {
         return false;
     }
 
-    value = head->data;
+    read_front(value);
     return true;
 }
 
@@ -271,11 +669,14 @@ template<typename T> size_t TSQueue<T>::size()
 *           longer than the max size, the queue will not be modified,
 *           but no more elements will be able to be added until the queue
 *           is shorter than the max_size
+*
+* @return true if the max size was changed
 */
-template<typename T> void TSQueue<T>::set_max_size(size_t size)
+template<typename T> bool TSQueue<T>::set_max_size(size_t size)
 {
-    std::lock_guard<std::recursive_mutex> lock(m);
+    std::lock_guard<mutex_type> lock(m);
     max_size = size;
+    return true;
 }
 
 /**
@@ -286,7 +687,7 @@ template<typename T> void TSQueue<T>::set_max_size(size_t size)
 
 template<typename T> size_t TSQueue<T>::get_max_size()
 {
-    std::lock_guard<std::recursive_mutex> lock(m);
+    std::lock_guard<mutex_type> lock(m);
     return max_size;
 }
 }
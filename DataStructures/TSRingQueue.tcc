@@ -0,0 +1,236 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file TSRingQueue.tcc
+ **/
+
+#pragma once
+
+#include "TSQueue.tcc"
+#include <vector>
+#include <utility>
+
+namespace acl
+{
+
+/**
+* @brief A thread-safe queue backed by a contiguous ring buffer
+*
+* Behaves exactly like TSQueue (same locking, blocking and max size rules),
+* but elements live in a preallocated array of slots instead of individually
+* allocated list nodes.  When the max size is finite, every slot is allocated
+* up front by set_max_size() and enqueue/dequeue never touch the allocator.
+* With the default (unbounded) max size the ring doubles whenever it fills.
+*
+* Dequeued slots are reset to T{}, so T must be default constructible and
+* assignable.
+*
+* @tparam T The type of data to be contained in the queue
+*/
+template <typename T> class TSRingQueue: public TSQueue<T>
+{
+private:
+    typedef TSQueue<T> Q;
+
+public:
+    TSRingQueue(size_t maxSize = DEFAULT_MAX_SIZE);       //<! Constructor
+    virtual bool set_max_size(size_t);                    //<! Sets max size and preallocates slots
+    virtual size_t capacity();                            //<! Returns the number of allocated slots
+
+protected:
+    std::vector<T> m_slots;                               //<! Ring storage
+    size_t m_first = 0;                                   //<! Slot index of the head
+
+    virtual void store_back(const T& data);
+    virtual void store_back(T&& data);
+    virtual void store_front(const T& data);
+    virtual void store_front(T&& data);
+    virtual void take_front(T& data);
+    virtual void read_front(T& data);
+    virtual void clear_storage();
+    void reserve(size_t slots);                           //<! Grows the ring to at least slots entries
+    size_t claim_back();                                  //<! Returns the free slot behind the tail
+    size_t claim_front();                                 //<! Returns the free slot ahead of the head
+};
+
+/**
+* @brief Constructor
+*
+* @param maxSize The maximum number of elements.  A finite value preallocates
+*        the ring so the hot path never allocates.
+**/
+template<typename T> TSRingQueue<T>::TSRingQueue(size_t maxSize)
+{
+    set_max_size(maxSize);
+}
+
+/**
+* @brief Sets the maximum size of the queue and, if it is finite, allocates
+*        enough slots to hold that many elements.  The ring is never shrunk.
+*
+* @return true if the max size was changed
+*/
+template<typename T> bool TSRingQueue<T>::set_max_size(size_t size)
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    Q::max_size = size;
+
+    if (size != DEFAULT_MAX_SIZE) {
+        reserve(size);
+    }
+    return true;
+}
+
+/**
+* @brief Returns the number of slots currently allocated
+*/
+template<typename T> size_t TSRingQueue<T>::capacity()
+{
+    std::lock_guard<typename Q::mutex_type> lock(Q::m);
+    return m_slots.size();
+}
+
+/**
+* @brief Reallocates the ring with at least the given number of slots,
+*        moving live elements so the head is at slot 0.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::reserve(size_t slots)
+{
+    if (slots <= m_slots.size()) {
+        return;
+    }
+
+    std::vector<T> temp(slots);
+    size_t index = m_first;
+
+    for (size_t i = 0; i < Q::length; i++) {
+        temp[i] = std::move(m_slots[index]);
+        if (++index == m_slots.size()) {
+            index = 0;
+        }
+    }
+
+    m_slots.swap(temp);
+    m_first = 0;
+}
+
+/**
+* @brief Makes room for one more element behind the tail.  Assumes m is held.
+*        The ring only grows when forced past its capacity or unbounded.
+*
+* @return The index of the slot to fill.  The caller counts it in length
+*         once the element has been assigned, so a throwing assignment
+*         leaves the queue unchanged.
+*/
+template<typename T> size_t TSRingQueue<T>::claim_back()
+{
+    if (Q::length == m_slots.size()) {
+        reserve(m_slots.empty() ? 16 : m_slots.size() * 2);
+    }
+
+    size_t index = m_first + Q::length;
+    if (index >= m_slots.size()) {
+        index -= m_slots.size();
+    }
+    return index;
+}
+
+/**
+* @brief Makes room for one more element ahead of the head.  Assumes m is held.
+*
+* @return The index of the slot to fill.  The caller makes it the new head
+*         once the element has been assigned.
+*/
+template<typename T> size_t TSRingQueue<T>::claim_front()
+{
+    if (Q::length == m_slots.size()) {
+        reserve(m_slots.empty() ? 16 : m_slots.size() * 2);
+    }
+
+    return m_first ? m_first - 1 : m_slots.size() - 1;
+}
+
+/**
+* @brief Copies data into the slot behind the tail.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::store_back(const T& data)
+{
+    m_slots[claim_back()] = data;
+    Q::length++;
+}
+
+/**
+* @brief Moves data into the slot behind the tail.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::store_back(T&& data)
+{
+    m_slots[claim_back()] = std::move(data);
+    Q::length++;
+}
+
+/**
+* @brief Copies data into the slot ahead of the head.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::store_front(const T& data)
+{
+    size_t index = claim_front();
+    m_slots[index] = data;
+    m_first = index;
+    Q::length++;
+}
+
+/**
+* @brief Moves data into the slot ahead of the head.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::store_front(T&& data)
+{
+    size_t index = claim_front();
+    m_slots[index] = std::move(data);
+    m_first = index;
+    Q::length++;
+}
+
+/**
+* @brief Moves the head out of its slot and resets the slot so it does not
+*        keep resources alive.  Assumes m is held and the queue is not empty.
+*/
+template<typename T> void TSRingQueue<T>::take_front(T& data)
+{
+    data = std::move(m_slots[m_first]);
+    m_slots[m_first] = T{};
+
+    if (++m_first == m_slots.size()) {
+        m_first = 0;
+    }
+    Q::length--;
+}
+
+/**
+* @brief Copies the head slot.  Assumes m is held and the queue is not empty.
+*/
+template<typename T> void TSRingQueue<T>::read_front(T& data)
+{
+    data = m_slots[m_first];
+}
+
+/**
+* @brief Resets every live slot, keeping the allocation.  Assumes m is held.
+*/
+template<typename T> void TSRingQueue<T>::clear_storage()
+{
+    size_t index = m_first;
+
+    for (size_t i = 0; i < Q::length; i++) {
+        m_slots[index] = T{};
+        if (++index == m_slots.size()) {
+            index = 0;
+        }
+    }
+
+    m_first = 0;
+    Q::length = 0;
+}
+}
@@ -0,0 +1,336 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file LockStats.cpp
+ **/
+
+#include "LockStats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace acl
+{
+    /**
+     * Raises an atomic maximum to value if it is larger
+     */
+    static void update_max( std::atomic<uint64_t>& max, uint64_t value )
+    {
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while( value > current &&
+               !max.compare_exchange_weak(current, value, std::memory_order_relaxed) ){
+        }
+    }
+
+    /**
+     * Escapes a string for use inside a JSON string literal
+     */
+    static std::string json_escape( const std::string& s )
+    {
+        std::ostringstream out;
+        for( char c : s ){
+            if( c == '"' || c == '\\' ){
+                out << '\\' << c;
+            } else if( (unsigned char)c < 0x20 ){
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+            } else {
+                out << c;
+            }
+        }
+        return out.str();
+    }
+
+    ////////////////////////////////
+    // LockStats implementation   //
+    ////////////////////////////////
+
+    /**
+     * Constructor
+     */
+    LockStats::LockStats( const std::string& name ): m_name(name)
+    {
+        reset();
+    }
+
+    /**
+     * Records one acquisition and how long it waited
+     *
+     * @param shared True for a shared (reader) acquisition
+     * @param wasContended True if the lock was not immediately available
+     * @param waitTime Nanoseconds spent waiting
+     */
+    void LockStats::record_acquire( bool shared, bool wasContended, uint64_t waitTime )
+    {
+        (shared ? sharedAcquisitions : acquisitions).fetch_add(1, std::memory_order_relaxed);
+        if( wasContended ){
+            (shared ? sharedContended : contended).fetch_add(1, std::memory_order_relaxed);
+            waitNs.fetch_add(waitTime, std::memory_order_relaxed);
+            update_max(maxWaitNs, waitTime);
+        }
+    }
+
+    /**
+     * Records how long an exclusive owner held the lock
+     */
+    void LockStats::record_hold( uint64_t holdTime )
+    {
+        holdNs.fetch_add(holdTime, std::memory_order_relaxed);
+        update_max(maxHoldNs, holdTime);
+    }
+
+    /**
+     * Zeroes every counter
+     */
+    void LockStats::reset()
+    {
+        acquisitions = 0;
+        contended = 0;
+        sharedAcquisitions = 0;
+        sharedContended = 0;
+        waitNs = 0;
+        maxWaitNs = 0;
+        holdNs = 0;
+        maxHoldNs = 0;
+    }
+
+    /**
+     * Returns the label of this lock
+     */
+    std::string LockStats::name() const
+    {
+        std::lock_guard<std::mutex> lock(m_nameMutex);
+        return m_name;
+    }
+
+    /**
+     * Sets the label of this lock
+     */
+    void LockStats::set_name( const std::string& name )
+    {
+        std::lock_guard<std::mutex> lock(m_nameMutex);
+        m_name = name;
+    }
+
+    /**
+     * Returns the nanoseconds elapsed since start
+     */
+    uint64_t LockStats::since( Clock::time_point start )
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    ////////////////////////////////
+    // LockRegistry implementation //
+    ////////////////////////////////
+
+    /**
+     * Returns the process-wide registry
+     */
+    LockRegistry& LockRegistry::instance()
+    {
+        static LockRegistry registry;
+        return registry;
+    }
+
+    /**
+     * Registers a new lock
+     *
+     * @param kind Type of the lock, used as the start of its default name
+     * @param owner Address used to tell instances of the same kind apart
+     * @return Returns the counters for the new lock
+     */
+    std::shared_ptr<LockStats> LockRegistry::create( const std::string& kind, const void* owner )
+    {
+        std::ostringstream name;
+        name << kind << "@" << owner;
+
+        std::shared_ptr<LockStats> stats = std::make_shared<LockStats>(name.str());
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Locks created and destroyed over and over must not grow the list
+        if( m_locks.size() >= m_pruneAt ){
+            prune();
+            m_pruneAt = std::max<size_t>(64, 2 * m_locks.size());
+        }
+        m_locks.push_back(stats);
+        return stats;
+    }
+
+    /**
+     * Drops the entries of destroyed locks.  Assumes m_mutex is held.
+     */
+    void LockRegistry::prune() const
+    {
+        m_locks.erase(std::remove_if(m_locks.begin(), m_locks.end(),
+                                     [](const std::weak_ptr<LockStats>& s) { return s.expired(); }),
+                      m_locks.end());
+    }
+
+    /**
+     * Returns the live locks so dumps do not hold m_mutex
+     */
+    std::vector<std::shared_ptr<LockStats>> LockRegistry::list() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        prune();
+
+        std::vector<std::shared_ptr<LockStats>> live;
+        live.reserve(m_locks.size());
+        for( auto& s : m_locks ){
+            if( std::shared_ptr<LockStats> stats = s.lock() ){
+                live.push_back(stats);
+            }
+        }
+        return live;
+    }
+
+    /**
+     * Writes one line per lock that has been used
+     */
+    void LockRegistry::dump_text( std::ostream& out ) const
+    {
+        out << std::left << std::setw(40) << "lock"
+            << std::right << std::setw(12) << "acquired" << std::setw(12) << "contended"
+            << std::setw(12) << "shared" << std::setw(12) << "shared ctd"
+            << std::setw(14) << "wait us" << std::setw(12) << "max wait us"
+            << std::setw(14) << "hold us" << std::setw(12) << "max hold us" << std::endl;
+
+        for( auto& s : list() ){
+            if( !s->acquisitions && !s->sharedAcquisitions ){
+                continue;
+            }
+            out << std::left << std::setw(40) << s->name()
+                << std::right << std::setw(12) << s->acquisitions << std::setw(12) << s->contended
+                << std::setw(12) << s->sharedAcquisitions << std::setw(12) << s->sharedContended
+                << std::setw(14) << s->waitNs / 1000 << std::setw(12) << s->maxWaitNs / 1000
+                << std::setw(14) << s->holdNs / 1000 << std::setw(12) << s->maxHoldNs / 1000 << std::endl;
+        }
+    }
+
+    /**
+     * Writes every lock as a JSON array of objects
+     */
+    void LockRegistry::dump_json( std::ostream& out ) const
+    {
+        bool first = true;
+
+        out << "[";
+        for( auto& s : list() ){
+            out << (first ? "" : ",") << "\n  {"
+                << "\"name\": \"" << json_escape(s->name()) << "\", "
+                << "\"acquisitions\": " << s->acquisitions << ", "
+                << "\"contended\": " << s->contended << ", "
+                << "\"sharedAcquisitions\": " << s->sharedAcquisitions << ", "
+                << "\"sharedContended\": " << s->sharedContended << ", "
+                << "\"waitNs\": " << s->waitNs << ", "
+                << "\"maxWaitNs\": " << s->maxWaitNs << ", "
+                << "\"holdNs\": " << s->holdNs << ", "
+                << "\"maxHoldNs\": " << s->maxHoldNs << "}";
+            first = false;
+        }
+        out << (first ? "]" : "\n]") << std::endl;
+    }
+
+    /**
+     * Zeroes the counters of every live lock
+     */
+    void LockRegistry::reset()
+    {
+        for( auto& s : list() ){
+            s->reset();
+        }
+    }
+
+    ////////////////////////////////
+    // AclMutex implementation    //
+    ////////////////////////////////
+
+    /**
+     * Constructor
+     *
+     * @param kind Start of the default name shown in dumps
+     */
+    AclMutex::AclMutex( const std::string& kind )
+        : m_stats(LockRegistry::instance().create(kind, this))
+    {
+    }
+
+    /**
+     * Locks, recording whether the lock was contended and for how long
+     */
+    void AclMutex::lock()
+    {
+        if( m_mutex.try_lock() ){
+            m_stats->record_acquire(false, false, 0);
+        } else {
+            LockStats::Clock::time_point start = LockStats::Clock::now();
+            m_mutex.lock();
+            m_stats->record_acquire(false, true, LockStats::since(start));
+        }
+        m_acquired = LockStats::Clock::now();
+    }
+
+    /**
+     * Checks if a lock is in place
+     *
+     * @return Returns false if there is a lock
+     */
+    bool AclMutex::try_lock()
+    {
+        if( !m_mutex.try_lock() ){
+            return false;
+        }
+        m_stats->record_acquire(false, false, 0);
+        m_acquired = LockStats::Clock::now();
+        return true;
+    }
+
+    /**
+     * Locks, giving up at the deadline
+     *
+     * @return Returns false if the lock was not acquired in time
+     */
+    bool AclMutex::timed_lock( LockStats::Clock::time_point deadline )
+    {
+        if( m_mutex.try_lock() ){
+            m_stats->record_acquire(false, false, 0);
+        } else {
+            LockStats::Clock::time_point start = LockStats::Clock::now();
+            if( !m_mutex.try_lock_until(deadline) ){
+                return false;
+            }
+            m_stats->record_acquire(false, true, LockStats::since(start));
+        }
+        m_acquired = LockStats::Clock::now();
+        return true;
+    }
+
+    /**
+     * Unlocks, recording how long the lock was held
+     */
+    void AclMutex::unlock()
+    {
+        m_stats->record_hold(LockStats::since(m_acquired));
+        m_mutex.unlock();
+    }
+
+    /**
+     * Sets the name shown in dumps
+     */
+    void AclMutex::set_name( const std::string& name )
+    {
+        m_stats->set_name(name);
+    }
+
+    /**
+     * Returns the counters of this lock
+     */
+    LockStats& AclMutex::stats()
+    {
+        return *m_stats;
+    }
+}
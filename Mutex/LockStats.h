@@ -0,0 +1,131 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file LockStats.h
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace acl
+{
+    /**
+     * @class LockStats
+     *
+     * @brief Contention counters for one lock
+     *
+     * Counters are updated with relaxed atomics so recording never takes a
+     * lock.  Times are in nanoseconds.  The LockRegistry only holds weak
+     * references, so a lock's entry goes away when the lock is destroyed.
+     * For acl::shared_mutex an upgrade lock counts as a shared acquisition,
+     * and the time it spends upgraded counts as an exclusive hold.
+     */
+    class LockStats
+    {
+        public:
+            typedef std::chrono::steady_clock Clock;
+
+            std::atomic<uint64_t> acquisitions;       //!< Brief exclusive acquisitions
+            std::atomic<uint64_t> contended;          //!< Brief exclusive acquisitions that had to wait
+            std::atomic<uint64_t> sharedAcquisitions; //!< Brief shared acquisitions
+            std::atomic<uint64_t> sharedContended;    //!< Brief shared acquisitions that had to wait
+            std::atomic<uint64_t> waitNs;             //!< Brief total time spent waiting to acquire
+            std::atomic<uint64_t> maxWaitNs;          //!< Brief longest single wait
+            std::atomic<uint64_t> holdNs;             //!< Brief total time held exclusively
+            std::atomic<uint64_t> maxHoldNs;          //!< Brief longest single exclusive hold
+
+            LockStats( const std::string& name );
+            LockStats( const LockStats& ) = delete;
+            LockStats& operator=( const LockStats& ) = delete;
+
+            void record_acquire( bool shared, bool wasContended, uint64_t waitTime );
+            void record_hold( uint64_t holdTime );
+            void reset();
+            std::string name() const;
+            void set_name( const std::string& name );
+
+            static uint64_t since( Clock::time_point start );
+
+        private:
+            mutable std::mutex m_nameMutex; //!< Brief guards m_name
+            std::string m_name; //!< Brief label used in dumps
+    };
+
+    /**
+     * @class LockRegistry
+     *
+     * @brief Process-wide list of instrumented locks, dumpable as text or JSON
+     */
+    class LockRegistry
+    {
+        public:
+            static LockRegistry& instance();
+
+            std::shared_ptr<LockStats> create( const std::string& kind, const void* owner );
+            void dump_text( std::ostream& out ) const;
+            void dump_json( std::ostream& out ) const;
+            void reset();
+
+        private:
+            LockRegistry() {}
+            std::vector<std::shared_ptr<LockStats>> list() const;
+            void prune() const;
+
+            mutable std::mutex m_mutex; //!< Brief guards m_locks
+            mutable std::vector<std::weak_ptr<LockStats>> m_locks; //!< Brief registered locks, some possibly destroyed
+            size_t m_pruneAt = 64; //!< Brief size of m_locks at which create() drops destroyed locks
+    };
+
+    /**
+     * @class AclMutex
+     *
+     * @brief Timed mutex that records its contention in the LockRegistry
+     *
+     * Drop-in replacement for std::mutex / std::timed_mutex.  Use with
+     * std::condition_variable_any.
+     */
+    class AclMutex
+    {
+        public:
+            AclMutex( const std::string& kind = "mutex" );
+            AclMutex( const AclMutex& ) = delete;
+            AclMutex& operator=( const AclMutex& ) = delete;
+
+            void lock();
+            bool try_lock();
+            void unlock();
+            template<class Rep, class Period>
+            bool try_lock_for( const std::chrono::duration<Rep, Period>& timeout )
+            {
+                return timed_lock(LockStats::Clock::now() +
+                        std::chrono::duration_cast<LockStats::Clock::duration>(timeout));
+            }
+            template<class Clock, class Duration>
+            bool try_lock_until( const std::chrono::time_point<Clock, Duration>& deadline )
+            {
+                return timed_lock(LockStats::Clock::now() +
+                        std::chrono::duration_cast<LockStats::Clock::duration>(deadline - Clock::now()));
+            }
+
+            void set_name( const std::string& name );
+            LockStats& stats();
+
+        private:
+            bool timed_lock( LockStats::Clock::time_point deadline );
+
+            std::timed_mutex m_mutex; //!< Brief the underlying lock
+            std::shared_ptr<LockStats> m_stats; //!< Brief counters for this lock
+            LockStats::Clock::time_point m_acquired; //!< Brief when the current owner got the lock
+    };
+}
@@ -8,6 +8,8 @@
  **/
 
 #include "shared_mutex.h"
+#include <algorithm>
+#include <thread>
 
 #ifdef USE_HELGRIND
 #include "helgrind.h"
@@ -15,6 +17,15 @@
 
 namespace acl
 {
+    /**
+     * Returns a small number unique to the calling thread, used to pick a reader slot
+     */
+    static unsigned thread_index()
+    {
+        static std::atomic_uint next(0);
+        static thread_local unsigned index = next++;
+        return index;
+    }
 
     shared_mutex::~shared_mutex()
     {
@@ -26,21 +37,154 @@ namespace acl
 
     /**
      * Constructor
+     *
+     * Allocates one reader slot per hardware thread, rounded up to a power
+     * of two and kept between 4 and 64.
      */
-    shared_mutex::shared_mutex(): readers(0)
+    shared_mutex::shared_mutex(): m_writer(false)
     {
+#ifdef DEBUG_CACHE
+        m_stats = LockRegistry::instance().create("shared_mutex", this);
+#endif
+        unsigned threads = std::thread::hardware_concurrency();
+        unsigned slots = 4;
+        while (slots < threads && slots < 64) {
+            slots <<= 1;
+        }
+
+        m_slotMask = slots - 1;
+        m_slots.reset(new ReaderSlot[slots]);
+        for (unsigned i = 0; i < slots; i++) {
+            m_slots[i].count = 0;
+        }
 #ifdef USE_HELGRIND
         // Due to virtual destructor, this should be a VTable pointer
         ANNOTATE_RWLOCK_CREATE(this);
 #endif //USE_HELGRIND
     }
 
+    /**
+     * Returns the reader counter for the calling thread
+     */
+    std::atomic_int& shared_mutex::reader_count()
+    {
+        return m_slots[thread_index() & m_slotMask].count;
+    }
+
+    /**
+     * Checks whether any reader slot is in use
+     *
+     * @return Returns true if a reader holds or is acquiring the lock
+     */
+    bool shared_mutex::readers_active() const
+    {
+        for (unsigned i = 0; i <= m_slotMask; i++) {
+            if (m_slots[i].count.load()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Releases a reader's count, waking a writer waiting for the readers
+     * to drain.
+     *
+     * The count is released before m_writer is read, and the writer raises
+     * m_writer before checking the counts under m_drainMutex, so either the
+     * writer sees this count gone or this reader sees m_writer and signals.
+     */
+    void shared_mutex::leave_shared(std::atomic_int& count)
+    {
+        count.fetch_sub(1);
+        if (m_writer.load()) {
+            std::lock_guard<std::mutex> lock(m_drainMutex);
+            m_drainCv.notify_all();
+        }
+    }
+
+    /**
+     * Waits for the current readers to leave.  Assumes m_mutex is held and
+     * m_writer is raised.
+     *
+     * Short read sections are waited out by yielding.  After that the
+     * writer sleeps until a leaving reader signals, so a long read section
+     * does not cost the writer a core.
+     *
+     * @param deadline When to give up, or nullptr to wait indefinitely
+     * @return Returns false if the deadline passed first
+     */
+    bool shared_mutex::drain_readers(const Deadline* deadline)
+    {
+        for (int spin = 0; spin < 64; spin++) {
+            if (!readers_active()) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(m_drainMutex);
+        while (readers_active()) {
+            if (!deadline) {
+                m_drainCv.wait(lock);
+            } else if (m_drainCv.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                return !readers_active();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Blocks a reader that backed off until the pending writer is done.
+     *
+     * m_mutex alone is not enough to wait on since an upgrader may hold it
+     * without blocking readers, so the writer flag is rechecked periodically.
+     *
+     * @param deadline When to give up, or nullptr to wait indefinitely
+     * @return Returns false if the deadline passed with the writer still pending
+     */
+    bool shared_mutex::wait_for_writer(const Deadline* deadline)
+    {
+        while (m_writer.load()) {
+            std::chrono::steady_clock::duration slice = std::chrono::milliseconds(1);
+            if (deadline) {
+                std::chrono::steady_clock::duration left = *deadline - std::chrono::steady_clock::now();
+                if (left <= std::chrono::steady_clock::duration::zero()) {
+                    return false;
+                }
+                slice = std::min(slice, left);
+            }
+
+            if (m_mutex.try_lock_for(slice)) {
+                m_mutex.unlock();
+                return true;
+            }
+        }
+        return true;
+    }
+
     /**
      * Locks a thread
+     *
+     * Excludes other writers with m_mutex, then announces itself so new
+     * readers back off, and waits for the current readers to leave.
      */
     void shared_mutex::lock()
     {
+#ifdef DEBUG_CACHE
+        // try_lock records uncontended acquisitions
+        if( try_lock() ){
+            return;
+        }
+        LockStats::Clock::time_point start = LockStats::Clock::now();
+#endif
         m_mutex.lock();
+        m_writer.store(true);
+        drain_readers(nullptr);
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(false, true, LockStats::since(start));
+        m_acquired = LockStats::Clock::now();
+#endif
 #ifdef USE_HELGRIND
         ANNOTATE_RWLOCK_ACQUIRED(this, 1);
 #endif //USE_HELGRIND
@@ -53,13 +197,24 @@ namespace acl
      */
     bool shared_mutex::try_lock()
     {
-        bool locked = m_mutex.try_lock();
-#ifdef USE_HELGRIND
-        if(locked) {
-            ANNOTATE_RWLOCK_ACQUIRED(this, 1);
+        if (!m_mutex.try_lock()) {
+            return false;
         }
+
+        m_writer.store(true);
+        if (readers_active()) {
+            m_writer.store(false);
+            m_mutex.unlock();
+            return false;
+        }
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(false, false, 0);
+        m_acquired = LockStats::Clock::now();
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 1);
 #endif //USE_HELGRIND
-        return locked;
+        return true;
     }
 
     /**
@@ -67,21 +222,48 @@ namespace acl
      */
     void shared_mutex::unlock()
     {
+#ifdef DEBUG_CACHE
+        m_stats->record_hold(LockStats::since(m_acquired));
+#endif
 #ifdef USE_HELGRIND
         ANNOTATE_RWLOCK_RELEASED(this, 1);
 #endif //USE_HELGRIND
+        m_writer.store(false, std::memory_order_release);
         m_mutex.unlock();
     }
 
     /**
      * Checks if a lock is in place
+     *
+     * Fast path: bump this thread's counter and check that no writer is
+     * pending.  The counter is published before m_writer is read, and the
+     * writer publishes m_writer before reading the counters, so at least one
+     * side always sees the other.
         */
     void shared_mutex::lock_shared()
     {
-        m_read.lock();
-        readers++;
-        if( readers == 1 ) m_mutex.lock();
-        m_read.unlock();
+        std::atomic_int& count = reader_count();
+#ifdef DEBUG_CACHE
+        bool waited = false;
+        LockStats::Clock::time_point start = LockStats::Clock::now();
+#endif
+
+        while (true) {
+            count.fetch_add(1);
+            if (!m_writer.load()) {
+                break;
+            }
+
+            // A writer is pending: step aside and wait for it to finish
+            leave_shared(count);
+#ifdef DEBUG_CACHE
+            waited = true;
+#endif
+            wait_for_writer(nullptr);
+        }
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(true, waited, waited ? LockStats::since(start) : 0);
+#endif
 #ifdef USE_HELGRIND
         ANNOTATE_RWLOCK_ACQUIRED(this, 0);
 #endif //USE_HELGRIND
@@ -94,36 +276,207 @@ namespace acl
      */
     bool shared_mutex::try_lock_shared()
     {
-        bool rc = true;
-        m_read.lock();
-        readers++;
-        if( readers == 1 ){
-            rc = m_mutex.try_lock();
-            if( !rc ){
-                readers--;
+        std::atomic_int& count = reader_count();
+
+        count.fetch_add(1);
+        if (m_writer.load()) {
+            leave_shared(count);
+            return false;
+        }
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(true, false, 0);
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 0);
+#endif //USE_HELGRIND
+        return true;
+    }
+
+    /**
+     * Unlocks a shared thread
+     */
+    void shared_mutex::unlock_shared()
+    {
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_RELEASED(this, 0);
+#endif //USE_HELGRIND
+        leave_shared(reader_count());
+    }
+
+    /**
+     * Locks exclusively, giving up at the deadline
+     *
+     * @return Returns false if the lock was not acquired in time
+     */
+    bool shared_mutex::timed_lock(Deadline deadline)
+    {
+#ifdef DEBUG_CACHE
+        if( try_lock() ){
+            return true;
+        }
+        LockStats::Clock::time_point start = LockStats::Clock::now();
+#endif
+        if (!m_mutex.try_lock_until(deadline)) {
+            return false;
+        }
+
+        m_writer.store(true);
+        if (!drain_readers(&deadline)) {
+            m_writer.store(false);
+            m_mutex.unlock();
+            return false;
+        }
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(false, true, LockStats::since(start));
+        m_acquired = LockStats::Clock::now();
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 1);
+#endif //USE_HELGRIND
+        return true;
+    }
+
+    /**
+     * Locks shared, giving up at the deadline
+     *
+     * @return Returns false if the lock was not acquired in time
+     */
+    bool shared_mutex::timed_lock_shared(Deadline deadline)
+    {
+        std::atomic_int& count = reader_count();
+#ifdef DEBUG_CACHE
+        bool waited = false;
+        LockStats::Clock::time_point start = LockStats::Clock::now();
+#endif
+
+        while (true) {
+            count.fetch_add(1);
+            if (!m_writer.load()) {
+                break;
+            }
+
+            leave_shared(count);
+#ifdef DEBUG_CACHE
+            waited = true;
+#endif
+            if (!wait_for_writer(&deadline)) {
+                return false;
             }
         }
-        m_read.unlock();
+#ifdef DEBUG_CACHE
+        m_stats->record_acquire(true, waited, waited ? LockStats::since(start) : 0);
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 0);
+#endif //USE_HELGRIND
+        return true;
+    }
+
+    /**
+     * Takes the upgrade lock.  Blocks other writers and upgraders, not readers
+     */
+    void shared_mutex::lock_upgrade()
+    {
+#ifdef DEBUG_CACHE
+        if( try_lock_upgrade() ){
+            return;
+        }
+        LockStats::Clock::time_point start = LockStats::Clock::now();
+        m_mutex.lock();
+        m_stats->record_acquire(true, true, LockStats::since(start));
+#else
+        m_mutex.lock();
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 0);
+#endif //USE_HELGRIND
+    }
+
+    /**
+     * Tries to take the upgrade lock without blocking
+     *
+     * @return Returns false if a writer or upgrader holds the lock
+     */
+    bool shared_mutex::try_lock_upgrade()
+    {
+        bool locked = m_mutex.try_lock();
+#ifdef DEBUG_CACHE
+        if(locked) {
+            m_stats->record_acquire(true, false, 0);
+        }
+#endif
 #ifdef USE_HELGRIND
-        if(rc) {
+        if(locked) {
             ANNOTATE_RWLOCK_ACQUIRED(this, 0);
         }
 #endif //USE_HELGRIND
-        return rc;
+        return locked;
     }
 
     /**
-     * Unlocks a shared thread
+     * Releases the upgrade lock
      */
-    void shared_mutex::unlock_shared()
+    void shared_mutex::unlock_upgrade()
     {
 #ifdef USE_HELGRIND
         ANNOTATE_RWLOCK_RELEASED(this, 0);
 #endif //USE_HELGRIND
-        m_read.lock();
-        readers--;
-        if( !readers ) m_mutex.unlock();
-        m_read.unlock();
+        m_mutex.unlock();
+    }
+
+    /**
+     * Turns the upgrade lock into an exclusive lock.  No other writer can
+     * get in between, so anything read under the upgrade lock is still valid.
+     */
+    void shared_mutex::unlock_upgrade_and_lock()
+    {
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_RELEASED(this, 0);
+#endif //USE_HELGRIND
+        m_writer.store(true);
+        drain_readers(nullptr);
+#ifdef DEBUG_CACHE
+        m_acquired = LockStats::Clock::now();
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_ACQUIRED(this, 1);
+#endif //USE_HELGRIND
+    }
+
+    /**
+     * Turns an exclusive lock into an upgrade lock, letting readers back in
+     */
+    void shared_mutex::unlock_and_lock_upgrade()
+    {
+#ifdef DEBUG_CACHE
+        m_stats->record_hold(LockStats::since(m_acquired));
+#endif
+#ifdef USE_HELGRIND
+        ANNOTATE_RWLOCK_RELEASED(this, 1);
+        ANNOTATE_RWLOCK_ACQUIRED(this, 0);
+#endif //USE_HELGRIND
+        m_writer.store(false, std::memory_order_release);
+    }
+
+    /**
+     * Turns the upgrade lock into a plain shared lock, letting writers in
+     * once this reader is done
+     */
+    void shared_mutex::unlock_upgrade_and_lock_shared()
+    {
+        reader_count().fetch_add(1);
+        m_mutex.unlock();
+    }
+
+    /**
+     * Sets the name this lock is listed under in the LockRegistry.  Does
+     * nothing unless built with DEBUG_CACHE.
+     */
+    void shared_mutex::set_lock_name( const std::string& name )
+    {
+#ifdef DEBUG_CACHE
+        m_stats->set_name(name);
+#endif
     }
 
 
@@ -179,11 +532,24 @@ namespace acl
         if( owns ) m_mutex->unlock_shared();
     }
 
+    /**
+     * Throws like std::shared_lock when locking a lock that is already
+     * owned, instead of taking a second, unbalanced shared lock
+     */
+    void shared_lock::check_not_owned() const
+    {
+        if( owns ){
+            throw std::system_error(std::make_error_code(std::errc::resource_deadlock_would_occur),
+                                    "shared_lock already owns its mutex");
+        }
+    }
+
     /**
      * Locks a thread
      */
     void shared_lock::lock()
     {
+        check_not_owned();
         m_mutex->lock_shared();
         owns = true;
     }
@@ -195,6 +561,7 @@ namespace acl
      */
     bool shared_lock::try_lock()
     {
+        check_not_owned();
         if( m_mutex->try_lock_shared() ){
             owns = true;
             return true;
@@ -220,4 +587,49 @@ namespace acl
     {
         return owns;
     }
+
+    /////////////////////////////////
+    // upgrade_lock implementation //
+    /////////////////////////////////
+
+    /**
+     * Constructor.  Takes the upgrade lock
+     */
+    upgrade_lock::upgrade_lock( shared_mutex& m ): m_mutex(&m), m_exclusive(false)
+    {
+        m_mutex->lock_upgrade();
+    }
+
+    /**
+     * Destructor.  Releases the upgrade or exclusive lock
+     */
+    upgrade_lock::~upgrade_lock()
+    {
+        if( m_exclusive ){
+            m_mutex->unlock();
+        } else {
+            m_mutex->unlock_upgrade();
+        }
+    }
+
+    /**
+     * Makes the lock exclusive.  Does nothing if it already is
+     */
+    void upgrade_lock::upgrade()
+    {
+        if( !m_exclusive ){
+            m_mutex->unlock_upgrade_and_lock();
+            m_exclusive = true;
+        }
+    }
+
+    /**
+     * Checks if the lock has been upgraded
+     * 
+     * @return Returns true if the lock is exclusive
+     */
+    bool upgrade_lock::is_exclusive() const
+    {
+        return m_exclusive;
+    }
 }
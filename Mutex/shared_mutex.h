@@ -11,6 +11,19 @@
 
 #include <mutex>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#ifdef DEBUG_CACHE
+#include "LockStats.h"
+#endif
+
+#ifndef ACL_CACHE_LINE_SIZE
+#define ACL_CACHE_LINE_SIZE 64
+#endif
 
 namespace acl
 {
@@ -18,18 +31,70 @@ namespace acl
      * @class shared_mutex
      *
      * @brief A class that allows threaded applications to lock threads and prevent deadlocks and race conditions
+     *
+     * Readers announce themselves in one of several cache-line padded
+     * counters chosen by thread, so concurrent lock_shared calls on different
+     * cores do not touch the same memory.  A writer takes m_mutex, raises
+     * m_writer and waits for every counter to drain: it spins briefly, then
+     * sleeps on m_drainCv, which readers signal when they leave while
+     * m_writer is raised.  Readers that see m_writer back off and wait on
+     * m_mutex, so a waiting writer is never starved by a stream of new
+     * readers.
+     *
+     * Shared locks are not recursive: a thread that already holds a shared
+     * lock must not take another one on the same mutex, since it would wait
+     * behind a pending writer that is waiting for it.  Locks must be released
+     * by the thread that took them.
+     *
+     * An upgrade lock is a shared lock that can later be turned into an
+     * exclusive one without letting another writer in between.  Only one
+     * thread can hold the upgrade lock, but it coexists with plain readers.
+     * It holds m_mutex without raising m_writer; upgrading raises m_writer
+     * and waits for the readers to drain.  A thread holding an upgrade lock
+     * must not also hold a shared lock on the same mutex.
      */
     class shared_mutex
     {
         private:
+            /**
+             * @brief Reader count for one group of threads, padded to its own cache line
+             */
+            struct ReaderSlot
+            {
+                std::atomic_int count;  //!< Brief readers in this slot
+                char pad[ACL_CACHE_LINE_SIZE];
+            };
+
+            std::timed_mutex m_mutex;  //!< Brief held by the writer or upgrader; readers wait on it while a writer is pending
 #ifdef DEBUG_CACHE
-			AclMutex m_read;
-			AclMutex m_mutex;
-#else
-            std::mutex m_read; //!< Brief readers
-            std::mutex m_mutex;  //!< Brief member fields for mutext
+            std::shared_ptr<LockStats> m_stats; //!< Brief contention counters in the LockRegistry
+            LockStats::Clock::time_point m_acquired; //!< Brief when the writer got the lock
 #endif
-            std::atomic_int readers; //!< Brief the number of readers
+            std::atomic_bool m_writer; //!< Brief true while a writer holds or is acquiring the lock
+            std::mutex m_drainMutex; //!< Brief guards the writer's sleep in drain_readers
+            std::condition_variable m_drainCv; //!< Brief signaled by readers leaving while m_writer is raised
+            std::unique_ptr<ReaderSlot[]> m_slots; //!< Brief distributed reader counters
+            unsigned m_slotMask; //!< Brief number of slots - 1
+
+            typedef std::chrono::steady_clock::time_point Deadline;
+
+            std::atomic_int& reader_count();
+            bool readers_active() const;
+            void leave_shared(std::atomic_int& count);
+            bool drain_readers(const Deadline* deadline);
+            bool wait_for_writer(const Deadline* deadline);
+            bool timed_lock(Deadline deadline);
+            bool timed_lock_shared(Deadline deadline);
+
+            /**
+             * @brief Converts a deadline on any clock to the steady clock
+             */
+            template<class Clock, class Duration>
+            static Deadline to_steady(const std::chrono::time_point<Clock, Duration>& deadline)
+            {
+                return std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(deadline - Clock::now());
+            }
 
         public:
             shared_mutex();
@@ -43,6 +108,39 @@ namespace acl
             bool try_lock_shared();
             void unlock_shared();
 
+            // timed locking
+            template<class Rep, class Period>
+            bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout)
+            {
+                return timed_lock(std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+            }
+            template<class Clock, class Duration>
+            bool try_lock_until(const std::chrono::time_point<Clock, Duration>& deadline)
+            {
+                return timed_lock(to_steady(deadline));
+            }
+            template<class Rep, class Period>
+            bool try_lock_shared_for(const std::chrono::duration<Rep, Period>& timeout)
+            {
+                return timed_lock_shared(std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+            }
+            template<class Clock, class Duration>
+            bool try_lock_shared_until(const std::chrono::time_point<Clock, Duration>& deadline)
+            {
+                return timed_lock_shared(to_steady(deadline));
+            }
+
+            // upgradeable locking
+            void lock_upgrade();
+            bool try_lock_upgrade();
+            void unlock_upgrade();
+            void unlock_upgrade_and_lock();
+            void unlock_and_lock_upgrade();
+            void unlock_upgrade_and_lock_shared();
+
+            void set_lock_name( const std::string& name );
     };
 
     /**
@@ -56,18 +154,69 @@ namespace acl
             shared_mutex* m_mutex; //!< Brief pointer to readers
             std::atomic_bool owns; //!< Brief boolean for whether the lock is owned
 
+            void check_not_owned() const;
+
         public:
             shared_lock( shared_mutex& m );
             shared_lock( shared_mutex& m, std::try_to_lock_t t );
             shared_lock( shared_mutex& m, std::defer_lock_t t );
             shared_lock( shared_mutex& m, std::adopt_lock_t t );
+            template<class Rep, class Period>
+            shared_lock( shared_mutex& m, const std::chrono::duration<Rep, Period>& timeout )
+                : m_mutex(&m), owns(m.try_lock_shared_for(timeout)) {}
+            template<class Clock, class Duration>
+            shared_lock( shared_mutex& m, const std::chrono::time_point<Clock, Duration>& deadline )
+                : m_mutex(&m), owns(m.try_lock_shared_until(deadline)) {}
             shared_lock( const shared_lock& other ) = delete;
             virtual ~shared_lock();
             void lock();
             bool try_lock();
+            template<class Rep, class Period>
+            bool try_lock_for( const std::chrono::duration<Rep, Period>& timeout )
+            {
+                check_not_owned();
+                if( m_mutex->try_lock_shared_for(timeout) ){
+                    owns = true;
+                    return true;
+                }
+                return false;
+            }
+            template<class Clock, class Duration>
+            bool try_lock_until( const std::chrono::time_point<Clock, Duration>& deadline )
+            {
+                check_not_owned();
+                if( m_mutex->try_lock_shared_until(deadline) ){
+                    owns = true;
+                    return true;
+                }
+                return false;
+            }
             void unlock();
             bool owns_lock() const;
     };
 
+    /**
+     * @class upgrade_lock
+     *
+     * @brief Holds an upgrade lock for read-then-maybe-write sections
+     *
+     * Reads under the lock do not block other readers.  upgrade() waits for
+     * them to finish and makes the lock exclusive; the destructor releases
+     * whichever mode is held.
+     */
+    class upgrade_lock
+    {
+        private:
+            shared_mutex* m_mutex; //!< Brief pointer to the locked mutex
+            bool m_exclusive; //!< Brief true once upgraded
+
+        public:
+            upgrade_lock( shared_mutex& m );
+            upgrade_lock( const upgrade_lock& other ) = delete;
+            virtual ~upgrade_lock();
+            void upgrade();
+            bool is_exclusive() const;
+    };
+
 }
 
@@ -0,0 +1,142 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file JobGroup.cpp
+ **/
+
+#include "JobGroup.h"
+
+namespace acl
+{
+
+/**
+* \brief creates a stopped group
+**/
+JobGroup::JobGroup(): m_running(false)
+{
+}
+
+/**
+* \brief waits for the group's jobs, which may refer to its owner
+**/
+JobGroup::~JobGroup()
+{
+    stop();
+}
+
+/**
+* \brief starts a pool of workers owned by this group
+*
+* \param [in] numThreads number of workers
+* \param [in] maxPending jobs that may wait for a worker before push_job() fails
+*
+* \return false if the group is already running or the workers did not start
+**/
+bool JobGroup::start(unsigned numThreads, size_t maxPending)
+{
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(numThreads, (int)maxPending);
+    if (!pool->Start()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pool) {
+        return false;
+    }
+    m_pool = pool;
+    m_owned = true;
+    m_running = true;
+    return true;
+}
+
+/**
+* \brief runs jobs on a pool that is already running, shared with its owner
+*
+* \param [in] pool the workers.  stop() leaves them running.
+*
+* \return false if the group is already running
+**/
+bool JobGroup::start(std::shared_ptr<ThreadPool> pool)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pool || !pool) {
+        return false;
+    }
+    m_pool = pool;
+    m_owned = false;
+    m_running = true;
+    return true;
+}
+
+/**
+* \brief queues a job on the group's pool
+*
+* \return false if the group is stopped or the pool's queue is full, in
+*      which case f was not queued
+**/
+bool JobGroup::push_job(std::function<void()> f)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_pool) {
+        return false;
+    }
+
+    m_pending++;
+    if (!m_pool->push_job([this, f] {
+            // Counts the job as done even if f throws, so stop() cannot hang
+            struct Finish {
+                JobGroup* group;
+                ~Finish() { group->finish_job(); }
+            } finish = {this};
+            f();
+        })) {
+        m_pending--;
+        return false;
+    }
+    return true;
+}
+
+/**
+* \brief returns true between start() and stop()
+**/
+bool JobGroup::running() const
+{
+    return m_running.load(std::memory_order_relaxed);
+}
+
+/**
+* \brief refuses new jobs, waits for the queued ones to finish and stops the
+*      pool if the group started it
+**/
+void JobGroup::stop()
+{
+    std::shared_ptr<ThreadPool> pool;
+    bool owned;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        pool = std::move(m_pool);
+        owned = m_owned;
+        m_running = false;
+        m_done.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    if (pool && owned) {
+        pool->Stop();
+        pool->Join();
+    }
+}
+
+/**
+* \brief counts a job as done, waking stop()
+**/
+void JobGroup::finish_job()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pending == 0) {
+        m_done.notify_all();
+    }
+}
+}
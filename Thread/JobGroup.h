@@ -0,0 +1,55 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+/**
+ * \file JobGroup.h
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "ThreadPool.h"
+
+namespace acl
+{
+
+    /**
+    * \brief jobs one client submits to a ThreadPool that it may share
+    *
+    * A group either starts a pool of its own or joins a running pool owned
+    * by someone else, such as the other shards of a cache.  It counts the
+    * jobs it pushed so that stop() waits for exactly those to finish, even
+    * while other groups keep the pool busy, and only stops the pool if it
+    * started it.
+    **/
+    class JobGroup
+    {
+    public:
+        JobGroup();
+        JobGroup(const JobGroup&) = delete;
+        JobGroup& operator=(const JobGroup&) = delete;
+        virtual ~JobGroup();
+
+        bool start(unsigned numThreads, size_t maxPending);
+        bool start(std::shared_ptr<ThreadPool> pool);
+        bool push_job(std::function<void()> f);
+        bool running() const;
+        void stop();
+
+    private:
+        void finish_job();
+
+        std::atomic_bool m_running;             //!< Brief set between start() and stop()
+        std::mutex m_mutex;                     //!< Brief guards everything below
+        std::condition_variable m_done;         //!< Brief signalled when m_pending drops to 0
+        std::shared_ptr<ThreadPool> m_pool;     //!< Brief workers running this group's jobs
+        bool m_owned = false;                   //!< Brief m_pool was started by this group
+        size_t m_pending = 0;                   //!< Brief jobs pushed and not yet finished
+    };
+}
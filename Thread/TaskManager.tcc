@@ -7,7 +7,9 @@
  * \file TaskManager.tcc
  **/
 
+#include <functional>
 #include <map>
+#include <mutex>
 #include <thread>
 #include <future>
 
@@ -16,19 +18,28 @@
 namespace acl
 {
 
-template<typename Key, typename ReturnType>
+/**
+ * @brief Runs one job per id at a time: callers asking for an id whose job
+ *      is already running wait for that job's result instead.
+ *
+ * @tparam Map Maps ids to the jobs in flight, e.g. an unordered_map
+ */
+template<typename Key, typename ReturnType,
+         typename Map = std::map<Key, std::shared_future<ReturnType>>>
 class TaskManager
 {
 public:
     ReturnType performJob(Key id, std::function<ReturnType(void)> f);
+    template<typename Lookup, typename Publish>
+    ReturnType performJob(Key id, std::function<ReturnType(void)> f, Lookup lookup, Publish publish);
 
 protected:
-    std::map<Key, std::shared_future<ReturnType>> m_futureMap;
+    Map m_futureMap;
     std::mutex m_mutex;
 };
 
-template<typename Key, typename ReturnType>
-ReturnType TaskManager<Key, ReturnType>::performJob(Key id, std::function<ReturnType(void)> f)
+template<typename Key, typename ReturnType, typename Map>
+ReturnType TaskManager<Key, ReturnType, Map>::performJob(Key id, std::function<ReturnType(void)> f)
 {
     std::shared_future<ReturnType> fut;
     bool added;
@@ -56,4 +67,66 @@ ReturnType TaskManager<Key, ReturnType>::performJob(Key id, std::function<Return
     return fut.get();
 }
 
+/**
+ * @brief Runs f unless a job for id is already running, or lookup finds a
+ *      result published by one that just finished.
+ *
+ * The caller that ran f passes its result to publish before the job is
+ * retired, so a later caller finds the result either through lookup or
+ * through the job.  If f throws, publish is not called and every waiting
+ * caller gets the exception.  If publish throws, only the caller that ran
+ * f gets that exception.
+ *
+ * @param lookup bool(ReturnType&), called with m_mutex held when no job for
+ *      id is running; returns true and sets its argument if the result is
+ *      already known
+ * @param publish void(const ReturnType&), called with the result of f,
+ *      e.g. to cache it
+ */
+template<typename Key, typename ReturnType, typename Map>
+template<typename Lookup, typename Publish>
+ReturnType TaskManager<Key, ReturnType, Map>::performJob(Key id, std::function<ReturnType(void)> f,
+                                                        Lookup lookup, Publish publish)
+{
+    std::shared_future<ReturnType> fut;
+    bool added;
+
+    std::unique_lock<std::mutex> l(m_mutex);
+    auto it = m_futureMap.find(id);
+    if(it != m_futureMap.end()) {
+        fut = it->second;
+        added = false;
+
+    } else {
+        ReturnType result;
+        if(lookup(result)) {
+            return result;
+        }
+
+        fut = std::async(std::launch::deferred, f).share();
+        m_futureMap.emplace(id, fut);
+        added = true;
+    }
+    l.unlock();
+
+    fut.wait();
+
+    if(added) {
+        try {
+            // Rethrows the exception of a failed job before anything is published
+            publish(fut.get());
+        } catch (...) {
+            l.lock();
+            m_futureMap.erase(id);
+            throw;
+        }
+
+        l.lock();
+        m_futureMap.erase(id);
+        l.unlock();
+    }
+
+    return fut.get();
+}
+
 }
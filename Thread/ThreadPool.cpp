@@ -17,14 +17,48 @@ namespace acl
 *
 * \param [in] numThreads the number of threads
 * \param [in] maxJobLength the maximum number of jobs that can be submitted
-* \param [in] timeout the time a thread should process before moving on
+* \param [in] timeout how long lock-free workers wait for a job, in milliseconds
+* \param [in] lockFree dispatch jobs through a lock-free MPMCQueue
 **/
-ThreadPool::ThreadPool(int numThreads, int maxJobLength, double timeout): MultiThread(numThreads), TSQueue<std::function<void()>>()
+ThreadPool::ThreadPool(int numThreads, int maxJobLength, double timeout, bool lockFree): MultiThread(numThreads), JobQueue()
 {
-    set_max_size(maxJobLength);
+    if (lockFree) {
+        m_lockFreeJobs.reset(new MPMCQueue<std::function<void()>>(maxJobLength));
+    } else {
+        JobQueue::set_max_size(maxJobLength);
+    }
     m_timeout = timeout;
 }
 
+/**
+* \brief stops and joins the workers before the job queues are destroyed
+**/
+ThreadPool::~ThreadPool()
+{
+    Stop();
+    Join();
+}
+
+/**
+* \brief starts the worker threads
+*
+* \return true if the threads were started
+**/
+bool ThreadPool::Start()
+{
+    JobQueue::resume_waits();
+    return MultiThread::Start();
+}
+
+/**
+* \brief tells the worker threads to stop and wakes any that are waiting for jobs
+**/
+void ThreadPool::Stop()
+{
+    MultiThread::Stop();
+    JobQueue::cancel_waits();
+}
+
 /**
 * \brief adds jobs to the pool
 *
@@ -33,7 +67,27 @@ ThreadPool::ThreadPool(int numThreads, int maxJobLength, double timeout): MultiT
 **/
 bool ThreadPool::push_job(std::function<void()> f)
 {
-    return enqueue(f);
+    if (m_lockFreeJobs) {
+        return m_lockFreeJobs->enqueue(std::move(f));
+    }
+    return enqueue(std::move(f));
+}
+
+/**
+* \brief adds a job to the pool ahead of all queued jobs with a lower priority
+*
+* \param [in] f the job to be added
+* \param [in] priority 0 (the priority of push_job(f)) to
+*        get_num_priorities() - 1; higher priorities are dispatched first.
+*        Ignored in lock-free mode.
+* \return true if the job has been successfully enqueued
+**/
+bool ThreadPool::push_job(std::function<void()> f, int priority)
+{
+    if (m_lockFreeJobs) {
+        return m_lockFreeJobs->enqueue(std::move(f));
+    }
+    return enqueue(std::move(f), priority);
 }
 
 /**
@@ -42,15 +96,87 @@ bool ThreadPool::push_job(std::function<void()> f)
 void ThreadPool::mainLoop()
 {
     std::function<void()> f;
-    if (dequeue(f, m_timeout) && f) {
+    bool rc;
+
+    if (m_lockFreeJobs) {
+        rc = m_lockFreeJobs->dequeue(f, m_timeout);
+    } else {
+        rc = dequeue(f, wait_forever);
+    }
+
+    if (rc && f) {
         f();
     }
 }
 
 /**
-* \brief sets the timeout value
+* \brief returns the number of queued jobs
+**/
+size_t ThreadPool::size()
+{
+    if (m_lockFreeJobs) {
+        return m_lockFreeJobs->size();
+    }
+    return JobQueue::size();
+}
+
+/**
+* \brief drops all queued jobs
+**/
+void ThreadPool::delete_all()
+{
+    if (m_lockFreeJobs) {
+        m_lockFreeJobs->delete_all();
+    } else {
+        JobQueue::delete_all();
+    }
+}
+
+/**
+* \brief sets the maximum number of queued jobs.  Has no effect in
+* lock-free mode, where the queue length is fixed at construction.
+*
+* \param [in] size the maximum number of jobs
+* \return false if the pool is lock-free and the call was ignored
+**/
+bool ThreadPool::set_max_size(size_t size)
+{
+    if (m_lockFreeJobs) {
+        return false;
+    }
+    return JobQueue::set_max_size(size);
+}
+
+/**
+* \brief returns the maximum number of queued jobs
+**/
+size_t ThreadPool::get_max_size()
+{
+    if (m_lockFreeJobs) {
+        return m_lockFreeJobs->get_max_size();
+    }
+    return JobQueue::get_max_size();
+}
+
+/**
+* \brief waits until there are no queued jobs
+*
+* \param [in] timeout the maximum number of milliseconds to wait, 0 waits indefinitely
+* \return true if the queue emptied, false on timeout
+**/
+bool ThreadPool::wait_until_empty(uint16_t timeout)
+{
+    if (m_lockFreeJobs) {
+        return m_lockFreeJobs->wait_until_empty(timeout);
+    }
+    return JobQueue::wait_until_empty(timeout);
+}
+
+/**
+* \brief sets how long lock-free workers wait for a job before re-checking
+* whether the pool is still running
 *
-* \param [in] timeout the timeout value to be set
+* \param [in] timeout the timeout value to be set, in milliseconds
 **/
 void ThreadPool::setTimeout(double timeout)
 {
@@ -11,7 +11,8 @@
 #define THREADPOOL_H_
 
 #include "MultiThread.h"
-#include "TSQueue.tcc"
+#include "TSPriorityQueue.tcc"
+#include "MPMCQueue.tcc"
 
 #include <functional>
 #include <atomic>
@@ -26,23 +27,42 @@ namespace acl
 
     /**
     * \brief class to run thread pool
+    *
+    * Jobs are dispatched through the inherited TSPriorityQueue by default,
+    * so jobs pushed with a higher priority run before queued bulk work.
+    * When constructed with lockFree set, jobs go through a bounded MPMCQueue
+    * instead so workers do not contend on a single mutex; in that mode the
+    * job queue length is fixed at construction (rounded up to a power of 2)
+    * and jobs run in FIFO order regardless of priority.
+    *
+    * Idle workers block until a job arrives; Stop() releases them.  The
+    * timeout only applies to the lock-free queue, whose workers re-check
+    * the running flag each time a wait expires.
     **/
-    class ThreadPool: public MultiThread, private TSQueue<std::function<void()>>
+    class ThreadPool: public MultiThread, private TSPriorityQueue<std::function<void()>>
     {
     public:
-        ThreadPool(int numThreads = 1, int maxJobLength = 50, double timeout = 1);
+        ThreadPool(int numThreads = 1, int maxJobLength = 50, double timeout = 1,
+                   bool lockFree = false);
+        virtual ~ThreadPool();
 
+        virtual bool Start();
+        virtual void Stop();
         bool push_job(std::function<void()> f);
+        bool push_job(std::function<void()> f, int priority);
         void setTimeout(double timeout);
 
-        using TSQueue<std::function<void()>>::size;
-        using TSQueue<std::function<void()>>::delete_all;
-        using TSQueue<std::function<void()>>::set_max_size;
-        using TSQueue<std::function<void()>>::get_max_size;
-        using TSQueue<std::function<void()>>::wait_until_empty;
+        size_t size();
+        void delete_all();
+        bool set_max_size(size_t);
+        size_t get_max_size();
+        bool wait_until_empty(uint16_t timeout = 0);
 
     private:
+        typedef TSPriorityQueue<std::function<void()>> JobQueue;
+
         std::atomic<double> m_timeout;                  //!< Timeout value of the thread pool
+        std::unique_ptr<MPMCQueue<std::function<void()>>> m_lockFreeJobs; //!< Job queue in lock-free mode
         virtual void mainLoop();
     };
 }
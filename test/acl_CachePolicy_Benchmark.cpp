@@ -0,0 +1,115 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+#include <HashLruCache.tcc>
+
+/// @brief Number of distinct keys in the synthetic working set
+static const size_t g_numHotKeys = 100000;
+
+/// @brief Number of working set requests in the synthetic trace
+static const size_t g_numRequests = 2000000;
+
+/// @brief Working set requests between sequential scans
+static const size_t g_scanPeriod = 200000;
+
+/// @brief Number of never-repeated keys in each scan
+static const size_t g_scanLength = 50000;
+
+/// @brief Builds a trace of Zipf-distributed requests over a working set,
+///        interrupted by periodic scans of keys that are only used once,
+///        like an archive sweep hitting a tile cache.
+std::vector<uint64_t> SyntheticTrace()
+{
+  // Zipf(0.99) through the inverse of its cumulative distribution
+  std::vector<double> cdf(g_numHotKeys);
+  double sum = 0;
+  for (size_t i = 0; i < g_numHotKeys; i++) {
+    sum += 1.0 / std::pow((double)(i + 1), 0.99);
+    cdf[i] = sum;
+  }
+
+  std::mt19937_64 rng(1);
+  std::uniform_real_distribution<double> dist(0, sum);
+  std::vector<uint64_t> trace;
+  uint64_t scanKey = g_numHotKeys;
+
+  for (size_t i = 0; i < g_numRequests; i++) {
+    if (i % g_scanPeriod == g_scanPeriod / 2) {
+      for (size_t s = 0; s < g_scanLength; s++) {
+        trace.push_back(scanKey++);
+      }
+    }
+    trace.push_back(std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin());
+  }
+  return trace;
+}
+
+/// @brief Reads a trace with one integer key per line
+std::vector<uint64_t> ReadTrace(const char* path)
+{
+  std::vector<uint64_t> trace;
+  std::ifstream in(path);
+  uint64_t key;
+  while (in >> key) {
+    trace.push_back(key);
+  }
+  return trace;
+}
+
+/// @brief Replays a trace as get_value(), then add_to_cache() on a miss
+/// @return Fraction of requests that hit
+double HitRatio(const std::vector<uint64_t>& trace, size_t cacheSize, acl::EvictionPolicy policy)
+{
+  acl::HashLruCache<uint64_t, uint64_t> cache(cacheSize);
+  cache.setEvictionPolicy(policy);
+
+  uint64_t value;
+  for (uint64_t key : trace) {
+    if (!cache.get_value(key, value)) {
+      cache.add_to_cache(key, key);
+    }
+  }
+
+  acl::CacheStats stats = cache.get_stats();
+  return (double)stats.hits / (stats.hits + stats.misses);
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<uint64_t> trace;
+  if (argc > 1) {
+    trace = ReadTrace(argv[1]);
+    std::cout << "Trace " << argv[1];
+  } else {
+    trace = SyntheticTrace();
+    std::cout << "Synthetic trace: Zipf(0.99) over " << g_numHotKeys << " keys with a "
+              << g_scanLength << " key scan every " << g_scanPeriod << " requests";
+  }
+  std::cout << ", " << trace.size() << " requests (hit ratio %)" << std::endl;
+  if (trace.empty()) {
+    std::cerr << "Empty trace" << std::endl;
+    return 1;
+  }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << std::setw(12) << "cache size" << std::setw(10) << "LRU"
+            << std::setw(10) << "SLRU" << std::setw(10) << "TinyLFU" << std::endl;
+  for (size_t size = 1000; size <= 64000; size *= 4) {
+    std::cout << std::setw(12) << size
+              << std::setw(10) << 100 * HitRatio(trace, size, acl::EvictionPolicy::LRU)
+              << std::setw(10) << 100 * HitRatio(trace, size, acl::EvictionPolicy::SLRU)
+              << std::setw(10) << 100 * HitRatio(trace, size, acl::EvictionPolicy::TINY_LFU)
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <LruCache.tcc>
+#include <HashLruCache.tcc>
+#include <ShardedLruCache.tcc>
+
+/// @brief Number of entries held by each cache
+static const int g_numEntries = 1000000;
+
+/// @brief Number of lookups timed per run
+static const size_t g_numLookups = 2000000;
+
+/// @brief Fills a cache to capacity with keys [0, g_numEntries)
+/// @return Seconds taken
+template<typename Cache> double FillCache(Cache& cache)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < g_numEntries; i++) {
+    cache.add_to_cache(i, i);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+/// @brief Times get_value() over a list of keys that are all cached
+/// @return Average nanoseconds per hit
+template<typename Cache> double BenchmarkHits(Cache& cache, const std::vector<int>& keys)
+{
+  size_t hits = 0;
+  int value;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (cache.get_value(keys[i], value)) {
+      hits++;
+    }
+  }
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  if (hits != keys.size()) {
+    std::cerr << "Only " << hits << " of " << keys.size() << " lookups hit" << std::endl;
+  }
+  return elapsed.count() / keys.size();
+}
+
+/// @brief Times add_to_cache() of new keys into a full cache, so every
+///        insert evicts the least recently used entry
+/// @return Average nanoseconds per insert
+template<typename Cache> double BenchmarkEvictions(Cache& cache)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < g_numLookups; i++) {
+    cache.add_to_cache(g_numEntries + (int)i, (int)i);
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / g_numLookups;
+}
+
+/// @brief Splits the lookups between threads that all hit the same cache
+/// @return Hits per second across all threads
+template<typename Cache> double BenchmarkThreadedHits(Cache& cache, const std::vector<int>& keys, unsigned numThreads)
+{
+  std::vector<std::thread> threads;
+  size_t perThread = keys.size() / numThreads;
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t] {
+      int value;
+      for (size_t i = t * perThread; i < (t + 1) * perThread; i++) {
+        cache.get_value(keys[i], value);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return perThread * numThreads / elapsed.count();
+}
+
+int main()
+{
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(0, g_numEntries - 1);
+  std::vector<int> keys(g_numLookups);
+  std::generate(keys.begin(), keys.end(), [&] { return dist(rng); });
+
+  acl::LruCache<int, int> lru;
+  acl::HashLruCache<int, int> hashLru;
+  lru.set_max_size(g_numEntries);
+  hashLru.set_max_size(g_numEntries);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "LRU caches with " << g_numEntries << " int entries, " << g_numLookups
+            << " random operations" << std::endl;
+  std::cout << std::setw(16) << "" << std::setw(14) << "LruCache" << std::setw(14) << "HashLruCache" << std::endl;
+  std::cout << std::setw(16) << "fill (s)"
+            << std::setw(14) << FillCache(lru) << std::setw(14) << FillCache(hashLru) << std::endl;
+  std::cout << std::setw(16) << "hit (ns)"
+            << std::setw(14) << BenchmarkHits(lru, keys) << std::setw(14) << BenchmarkHits(hashLru, keys) << std::endl;
+  std::cout << std::setw(16) << "evict+add (ns)"
+            << std::setw(14) << BenchmarkEvictions(lru) << std::setw(14) << BenchmarkEvictions(hashLru) << std::endl;
+
+  acl::HashLruCache<int, int> single;
+  acl::HashLruCache<int, int, std::hash<int>, acl::shared_mutex> clock;
+  acl::ShardedLruCache<int, int> sharded(64);
+  acl::ShardedLruCache<int, int, std::hash<int>, acl::shared_mutex> shardedClock(64);
+  clock.setClockRecency(true);
+  shardedClock.setClockRecency(true);
+  single.set_max_size(g_numEntries);
+  clock.set_max_size(g_numEntries);
+  sharded.set_max_size(g_numEntries);
+  shardedClock.set_max_size(g_numEntries);
+  FillCache(single);
+  FillCache(clock);
+  FillCache(sharded);
+  FillCache(shardedClock);
+
+  std::cout << std::endl << "Concurrent hits, " << std::thread::hardware_concurrency()
+            << " hardware threads (Mhits/s)" << std::endl;
+  std::cout << std::setw(16) << "threads" << std::setw(14) << "HashLruCache" << std::setw(14) << "CLOCK"
+            << std::setw(16) << "Sharded x64" << std::setw(16) << "Sharded CLOCK" << std::endl;
+  for (unsigned threads = 1; threads <= 32; threads *= 2) {
+    std::cout << std::setw(16) << threads
+              << std::setw(14) << BenchmarkThreadedHits(single, keys, threads) / 1e6
+              << std::setw(14) << BenchmarkThreadedHits(clock, keys, threads) / 1e6
+              << std::setw(16) << BenchmarkThreadedHits(sharded, keys, threads) / 1e6
+              << std::setw(16) << BenchmarkThreadedHits(shardedClock, keys, threads) / 1e6 << std::endl;
+  }
+
+  return 0;
+}
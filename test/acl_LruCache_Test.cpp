@@ -0,0 +1,815 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <LruCache.tcc>
+#include <HashLruCache.tcc>
+#include <ShardedLruCache.tcc>
+
+/// @brief Checks hits, misses, LRU eviction order and cleanup handler
+///        refusals of a cache.
+/// @param [in] cache Empty cache to test
+/// @return 0 on success, unique error code on failure.
+template<typename Cache> int TestCacheSemantics(Cache& cache)
+{
+  std::string value;
+  cache.set_max_size(3);
+
+  if (cache.get_value(1, value)) {
+    std::cerr << "Hit in an empty cache" << std::endl;
+    return 1;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!cache.add_to_cache(i, std::to_string(i))) {
+      std::cerr << "Failed to add " << i << std::endl;
+      return 2;
+    }
+  }
+  if (cache.add_to_cache(1, "again")) {
+    std::cerr << "Added a duplicate key" << std::endl;
+    return 3;
+  }
+  if (!cache.get_value(1, value) || value != "1") {
+    std::cerr << "Expected 1, got " << value << std::endl;
+    return 4;
+  }
+
+  // 1 was just used, so 0 goes first and then 2
+  std::vector<int> booted;
+  cache.setCleanupHandler([&](int key, std::string) { booted.push_back(key); return true; });
+  cache.add_to_cache(3, "3");
+  cache.add_to_cache(4, "4");
+  if (booted != std::vector<int>({0, 2}) || cache.size() != 3) {
+    std::cerr << "Evicted in the wrong order" << std::endl;
+    return 5;
+  }
+  if (cache.get_value(0, value) || !cache.get_value(1, value) || !cache.get_value(4, value)) {
+    std::cerr << "Wrong entries left after eviction" << std::endl;
+    return 6;
+  }
+
+  // Refused evictions stay cached and the next entry is booted instead
+  booted.clear();
+  cache.setCleanupHandler([&](int key, std::string) { booted.push_back(key); return key != 3; });
+  cache.add_to_cache(5, "5");
+  if (booted != std::vector<int>({3, 1}) || !cache.get_value(3, value) || cache.get_value(1, value)) {
+    std::cerr << "Refused eviction was not kept" << std::endl;
+    return 7;
+  }
+  cache.setCleanupHandler();
+
+  cache.empty_cache();
+  if (cache.size() != 0 || cache.get_value(3, value)) {
+    std::cerr << "empty_cache left entries" << std::endl;
+    return 8;
+  }
+  return 0;
+}
+
+/// @brief Hammers a small cache from several threads and checks every hit
+///        returns the value stored for its key.
+/// @return 0 on success, unique error code on failure.
+template<typename Cache> int TestCacheThreads(Cache& cache)
+{
+  std::atomic_int errors(0);
+  std::vector<std::thread> threads;
+
+  cache.set_max_size(64);
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t] {
+      int value;
+      for (int i = 0; i < 20000; i++) {
+        int key = (i * 7 + t * 13) % 256;
+        if (cache.get_value(key, value)) {
+          if (value != key * 2) {
+            errors++;
+          }
+        } else {
+          cache.add_to_cache(key, key * 2);
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  if (errors != 0) {
+    std::cerr << errors << " hits returned the wrong value" << std::endl;
+    return 1;
+  }
+  if (cache.size() > 64) {
+    std::cerr << "Cache grew to " << cache.size() << " entries" << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+/// @brief Checks eviction by total weight and the hit, miss and eviction
+///        counters of a cache.
+/// @param [in] cache Empty cache to test
+/// @return 0 on success, unique error code on failure.
+template<typename Cache> int TestCacheWeights(Cache& cache)
+{
+  std::string value;
+  cache.reset_stats();
+  cache.setWeightFunction([](const int&, const std::string& v) { return v.size(); });
+  cache.set_max_weight(10);
+
+  cache.add_to_cache(1, "aaaa");
+  cache.add_to_cache(2, "bbbb");
+  if (cache.get_weight() != 8) {
+    std::cerr << "Weight is " << cache.get_weight() << ", expected 8" << std::endl;
+    return 1;
+  }
+  cache.add_to_cache(3, "ccc");
+  if (cache.get_weight() != 7 || cache.get_value(1, value) || !cache.get_value(2, value)) {
+    std::cerr << "Did not evict down to the weight capacity" << std::endl;
+    return 2;
+  }
+  if (cache.add_to_cache(4, "ddddddddddd") || cache.get_weight() != 7) {
+    std::cerr << "Added an entry heavier than the whole cache" << std::endl;
+    return 3;
+  }
+
+  // 3 is least recently used, and 2 also has to go to fit 9
+  cache.add_to_cache(5, "eeeeeeeee");
+  acl::CacheStats stats = cache.get_stats();
+  if (stats.hits != 1 || stats.misses != 1 || stats.evictions != 3 ||
+      stats.entries != 1 || stats.weight != 9) {
+    std::cerr << "Counted " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.evictions << " evictions, " << stats.entries << " entries, weight "
+              << stats.weight << std::endl;
+    return 4;
+  }
+
+  cache.reset_stats();
+  cache.empty_cache();
+  stats = cache.get_stats();
+  if (stats.hits != 0 || stats.evictions != 0 || stats.weight != 0) {
+    std::cerr << "Counters not cleared" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+/// @brief Checks that SLRU keeps entries that were hit through a scan of
+///        new keys, and that TinyLFU only admits keys used more often than
+///        the entry they would evict.
+/// @return 0 on success, unique error code on failure.
+int TestEvictionPolicies()
+{
+  int value;
+  acl::EvictionPolicy policies[] = {acl::EvictionPolicy::LRU, acl::EvictionPolicy::SLRU};
+  for (acl::EvictionPolicy policy : policies) {
+    acl::HashLruCache<int, int> cache(10);
+    cache.setEvictionPolicy(policy);
+    for (int i = 0; i < 5; i++) {
+      cache.add_to_cache(i, i);
+      cache.get_value(i, value);
+    }
+    for (int i = 100; i < 200; i++) {
+      cache.add_to_cache(i, i);
+    }
+
+    int hot = 0;
+    for (int i = 0; i < 5; i++) {
+      hot += cache.get_value(i, value);
+    }
+    if (hot != (policy == acl::EvictionPolicy::SLRU ? 5 : 0) || cache.size() != 10) {
+      std::cerr << hot << " of 5 hit entries survived a scan" << std::endl;
+      return 1;
+    }
+  }
+
+  acl::HashLruCache<int, int> cache(10);
+  cache.setEvictionPolicy(acl::EvictionPolicy::TINY_LFU);
+  for (int i = 0; i < 10; i++) {
+    cache.add_to_cache(i, i);
+    for (int hit = 0; hit < 3; hit++) {
+      cache.get_value(i, value);
+    }
+  }
+  if (cache.add_to_cache(100, 100) || cache.get_stats().rejections != 1 || cache.size() != 10) {
+    std::cerr << "Admitted a new key over a popular one" << std::endl;
+    return 2;
+  }
+  for (int miss = 0; miss < 10; miss++) {
+    cache.get_value(100, value);
+  }
+  if (!cache.add_to_cache(100, 100) || !cache.get_value(100, value) || cache.size() != 10) {
+    std::cerr << "Did not admit a frequently requested key" << std::endl;
+    return 3;
+  }
+  return 0;
+}
+
+/// @brief Checks that with CLOCK recency a hit still saves an entry from
+///        eviction under LRU and SLRU, and that TINY_LFU and caches whose
+///        lock cannot be shared refuse CLOCK
+/// @return 0 on success, unique error code on failure.
+int TestClockRecency()
+{
+  typedef acl::HashLruCache<int, int, std::hash<int>, acl::shared_mutex> ClockCache;
+  int value;
+  acl::EvictionPolicy policies[] = {acl::EvictionPolicy::LRU, acl::EvictionPolicy::SLRU};
+  for (acl::EvictionPolicy policy : policies) {
+    ClockCache cache(3);
+    cache.setEvictionPolicy(policy);
+    cache.setClockRecency(true);
+    for (int i = 0; i < 3; i++) {
+      cache.add_to_cache(i, i);
+    }
+    cache.get_value(0, value);
+    cache.get_value(0, value);
+
+    // 0 was hit, so 1 goes first
+    if (!cache.add_to_cache(3, 3)) {
+      std::cerr << "Wrong admission under CLOCK recency" << std::endl;
+      return 1;
+    }
+    if (!cache.get_value(0, value) || value != 0 || cache.get_value(1, value)) {
+      std::cerr << "CLOCK evicted a referenced entry" << std::endl;
+      return 2;
+    }
+    if (cache.get_stats().hits != 3 || cache.get_stats().misses != 1) {
+      std::cerr << "CLOCK hits not counted" << std::endl;
+      return 3;
+    }
+  }
+
+  // CLOCK hits never reach the TinyLFU sketch, so the two do not mix
+  ClockCache clock;
+  clock.setClockRecency(true);
+  ClockCache tinyLfu;
+  tinyLfu.setEvictionPolicy(acl::EvictionPolicy::TINY_LFU);
+  if (clock.setEvictionPolicy(acl::EvictionPolicy::TINY_LFU) || tinyLfu.setClockRecency(true) ||
+      clock.getEvictionPolicy() != acl::EvictionPolicy::LRU || tinyLfu.getClockRecency()) {
+    std::cerr << "Combined TINY_LFU with CLOCK recency" << std::endl;
+    return 4;
+  }
+
+  // With a plain mutex every hit would still be exclusive
+  acl::HashLruCache<int, int> exclusive;
+  acl::ShardedLruCache<int, int> sharded(2);
+  if (exclusive.setClockRecency(true) || exclusive.getClockRecency() ||
+      sharded.setClockRecency(true) || !exclusive.setClockRecency(false)) {
+    std::cerr << "Enabled CLOCK recency without a shared lock" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+/// @brief Checks that a slow cleanup handler runs off the inserting thread,
+///        that refused evictions are put back and that nothing is lost when
+///        the queue fills up
+/// @return 0 on success, unique error code on failure.
+template<typename Cache> int TestAsyncCleanup()
+{
+  std::atomic<int> calls(0);
+  auto slowHandler = [&calls](int, int) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    calls++;
+    return true;
+  };
+
+  for (size_t maxPending : {size_t(64), size_t(2)}) {
+    calls = 0;
+    Cache cache;
+    cache.set_max_size(10);
+    cache.setCleanupHandler(slowHandler);
+    if (!cache.startAsyncCleanup(1, maxPending) || cache.startAsyncCleanup()) {
+      std::cerr << "Async cleanup did not start exactly once" << std::endl;
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 30; i++) {
+      cache.add_to_cache(i, i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // 20 evictions at 20 ms each would take 400 ms on this thread
+    if (maxPending > 20 && elapsed > std::chrono::milliseconds(200)) {
+      std::cerr << "Inserts waited for the cleanup handler" << std::endl;
+      return 2;
+    }
+
+    cache.stopAsyncCleanup();
+    if (calls != 20 || cache.size() != 10) {
+      std::cerr << "Async cleanup lost evictions: " << calls << " handler calls" << std::endl;
+      return 3;
+    }
+  }
+
+  Cache cache;
+  cache.set_max_size(2);
+  cache.setCleanupHandler([](int, int) { return false; });
+  cache.startAsyncCleanup();
+  for (int i = 0; i < 3; i++) {
+    cache.add_to_cache(i, i);
+  }
+  cache.stopAsyncCleanup();
+  int value;
+  if (cache.size() != 3 || !cache.get_value(0, value) || value != 0) {
+    std::cerr << "Refused async eviction was not put back" << std::endl;
+    return 4;
+  }
+
+  // A handler that throws on a worker keeps its entry like a refusal
+  Cache throwing;
+  throwing.set_max_size(2);
+  throwing.setCleanupHandler([](int, int) -> bool { throw std::runtime_error("cleanup failed"); });
+  throwing.startAsyncCleanup();
+  for (int i = 0; i < 3; i++) {
+    throwing.add_to_cache(i, i);
+  }
+  throwing.stopAsyncCleanup();
+  if (throwing.size() != 3 || !throwing.get_value(0, value) || value != 0) {
+    std::cerr << "Throwing async cleanup handler lost its entry" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+/// @brief Checks that concurrent get_or_load() calls for one key share a
+///        single loader call and that a failed load is not cached
+/// @param [in] cache Empty cache to test
+/// @return 0 on success, unique error code on failure.
+template<typename Cache> int TestGetOrLoad(Cache& cache)
+{
+  std::atomic<int> loads(0);
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&]() {
+      int value = cache.get_or_load(7, [&loads]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        loads++;
+        return 49;
+      });
+      if (value != 49) {
+        wrong++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  int value;
+  if (loads != 1 || wrong != 0) {
+    std::cerr << "get_or_load ran " << loads << " loaders for one key" << std::endl;
+    return 1;
+  }
+  if (!cache.get_value(7, value) || value != 49) {
+    std::cerr << "get_or_load did not cache the loaded value" << std::endl;
+    return 2;
+  }
+
+  bool threw = false;
+  try {
+    cache.get_or_load(8, []() -> int { throw std::runtime_error("load failed"); });
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  if (!threw || cache.get_value(8, value)) {
+    std::cerr << "get_or_load mishandled a failed load" << std::endl;
+    return 3;
+  }
+  if (cache.get_or_load(8, []() { return 64; }) != 64) {
+    std::cerr << "get_or_load did not retry after a failed load" << std::endl;
+    return 4;
+  }
+
+  // A failure to cache a loaded value is not swallowed
+  cache.set_max_size(4);
+  for (int i = 0; i < 100; i++) {
+    cache.add_to_cache(i, i);
+  }
+  cache.setCleanupHandler([](int, int) -> bool { throw std::runtime_error("cleanup failed"); });
+  threw = false;
+  try {
+    cache.get_or_load(1000, []() { return 1; });
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  cache.setCleanupHandler();
+  if (!threw || cache.get_or_load(1000, []() { return 2; }) != 2) {
+    std::cerr << "get_or_load mishandled a failure to cache" << std::endl;
+    return 5;
+  }
+
+  // The victim of a throwing handler stays cached
+  cache.setCleanupHandler([](int, int) -> bool { throw std::runtime_error("cleanup failed"); });
+  size_t before = cache.size();
+  threw = false;
+  try {
+    cache.add_to_cache(2000, 1);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  cache.setCleanupHandler();
+  if (!threw || cache.size() != before || !cache.get_value(1000, value) || cache.get_value(2000, value)) {
+    std::cerr << "Lost the victim of a throwing cleanup handler" << std::endl;
+    return 6;
+  }
+  return 0;
+}
+
+/// @brief Checks LruCache time to live: lazy expiry on lookup, replacing
+///        expired keys, and the sweeper reclaiming entries nobody looks up
+/// @return 0 on success, unique error code on failure.
+int TestLruCacheTtl()
+{
+  using std::chrono::milliseconds;
+  int value;
+  acl::LruCache<int, int> cache;
+
+  cache.add_to_cache(1, 1, milliseconds(30));
+  cache.add_to_cache(2, 2);
+  cache.set_default_ttl(milliseconds(30));
+  cache.add_to_cache(3, 3);
+  cache.set_default_ttl(milliseconds(0));
+  std::this_thread::sleep_for(milliseconds(60));
+  if (cache.get_value(1, value) || cache.get_value(3, value) || !cache.get_value(2, value) ||
+      cache.size() != 1) {
+    std::cerr << "Expired entries were returned" << std::endl;
+    return 1;
+  }
+  if (!cache.add_to_cache(3, 4) || !cache.get_value(3, value) || value != 4) {
+    std::cerr << "Expired key was not replaced" << std::endl;
+    return 2;
+  }
+  cache.add_to_cache(5, 5, milliseconds(10));
+  cache.add_to_cache(6, 6);
+  std::this_thread::sleep_for(milliseconds(20));
+  if (!cache.get_lower_bound(4, value) || value != 6 || cache.size() != 3) {
+    std::cerr << "get_lower_bound returned an expired entry" << std::endl;
+    return 7;
+  }
+
+  int cleanups = 0;
+  cache.set_max_size(2);
+  cache.setCleanupHandler([&cleanups](int, int) { cleanups++; return true; });
+  cache.empty_cache();
+  cache.add_to_cache(1, 1, milliseconds(10));
+  cache.add_to_cache(2, 2);
+  std::this_thread::sleep_for(milliseconds(20));
+  cache.add_to_cache(3, 3);
+  if (cleanups != 0 || cache.size() != 2) {
+    std::cerr << "Expired entry went through the cleanup handler" << std::endl;
+    return 3;
+  }
+
+  // 8 slots of 10 ms, so the 300 ms entries go round the wheel
+  cache.setCleanupHandler();
+  cache.set_max_size(1000);
+  cache.empty_cache();
+  if (!cache.startSweeper(milliseconds(10), 8) || cache.startSweeper()) {
+    std::cerr << "Sweeper did not start exactly once" << std::endl;
+    return 4;
+  }
+  for (int i = 0; i < 100; i++) {
+    cache.add_to_cache(i, i, milliseconds(30));
+  }
+  for (int i = 100; i < 110; i++) {
+    cache.add_to_cache(i, i, milliseconds(300));
+  }
+  for (int i = 110; i < 115; i++) {
+    cache.add_to_cache(i, i);
+  }
+  std::this_thread::sleep_for(milliseconds(150));
+  if (cache.size() != 15) {
+    std::cerr << "Sweeper left " << cache.size() << " entries, expected 15" << std::endl;
+    return 5;
+  }
+  std::this_thread::sleep_for(milliseconds(300));
+  if (cache.size() != 5) {
+    std::cerr << "Sweeper left " << cache.size() << " entries, expected 5" << std::endl;
+    return 6;
+  }
+
+  // 1 expires while its refused eviction is out, so the sweep misses it
+  cache.empty_cache();
+  cache.set_max_size(1);
+  cache.setCleanupHandler([](int, int) {
+    std::this_thread::sleep_for(milliseconds(60));
+    return false;
+  });
+  cache.startAsyncCleanup();
+  cache.add_to_cache(1, 1, milliseconds(30));
+  cache.add_to_cache(2, 2);
+  cache.stopAsyncCleanup();
+  cache.setCleanupHandler();
+  std::this_thread::sleep_for(milliseconds(50));
+  if (cache.size() != 1) {
+    std::cerr << "Sweeper missed a restored entry" << std::endl;
+    return 8;
+  }
+  cache.stopSweeper();
+  return 0;
+}
+
+/// @brief Checks LruCache range scans and lower bounds, with and without
+///        recency updates
+/// @return 0 on success, unique error code on failure.
+int TestLruCacheRange()
+{
+  int value;
+  acl::LruCache<int, int> cache;
+  cache.set_max_size(10);
+  for (int i = 0; i < 100; i += 10) {
+    cache.add_to_cache(i, 2 * i);
+  }
+
+  std::vector<std::pair<int, int>> range = cache.get_range(25, 60);
+  std::vector<std::pair<int, int>> expected = {{30, 60}, {40, 80}, {50, 100}, {60, 120}};
+  if (range != expected) {
+    std::cerr << "get_range returned " << range.size() << " wrong entries" << std::endl;
+    return 1;
+  }
+  if (!cache.get_range(95, 100).empty() || !cache.get_range(60, 25).empty()) {
+    std::cerr << "get_range returned entries out of bounds" << std::endl;
+    return 2;
+  }
+
+  // A scan without recency updates leaves 0 the least recently used
+  cache.get_range(0, 40, false);
+  cache.add_to_cache(100, 200);
+  if (cache.get_value(0, value)) {
+    std::cerr << "get_range updated recency when told not to" << std::endl;
+    return 3;
+  }
+  // The first scan moved 30 to 60 back, so 10 and 20 are next unless used
+  cache.get_range(10, 20);
+  cache.add_to_cache(110, 220);
+  if (!cache.get_value(10, value) || !cache.get_value(20, value) || cache.get_value(70, value)) {
+    std::cerr << "get_range did not update recency" << std::endl;
+    return 4;
+  }
+
+  cache.add_to_cache(45, 90, std::chrono::milliseconds(10));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  if (!cache.get_lower_bound(41, value) || value != 100 || cache.get_range(41, 49).size() != 0) {
+    std::cerr << "Range queries returned an expired entry" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+/// @brief Checks that an LruCache snapshot restores keys, values and
+///        recency order, with and without a value codec
+/// @return 0 on success, unique error code on failure.
+int TestLruCacheSnapshot()
+{
+  typedef acl::LruCache<int, std::string> Cache;
+  auto encode = [](std::ostream& out, const std::string& value) {
+    return acl::SnapshotCodec<std::string>::write(out, value);
+  };
+  auto decode = [](std::istream& in, std::string& value) {
+    return acl::SnapshotCodec<std::string>::read(in, value);
+  };
+
+  std::string value;
+  Cache saved;
+  saved.set_max_size(11);
+  for (int i = 0; i < 10; i++) {
+    saved.add_to_cache(i, std::to_string(i));
+  }
+  saved.get_value(0, value);
+  saved.add_to_cache(-1, "expired", std::chrono::milliseconds(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+  const char* path = "acl_LruCache_Test.snapshot";
+  if (!saved.save_snapshot(path, encode)) {
+    std::cerr << "Couldn't save a snapshot" << std::endl;
+    return 1;
+  }
+
+  // 1 is least recently used in the snapshot, so a new key evicts it
+  Cache loaded;
+  loaded.set_max_size(10);
+  if (loaded.load_snapshot(path, decode) != 10 || !loaded.get_value(9, value) || value != "9") {
+    std::cerr << "Snapshot values were not restored" << std::endl;
+    return 2;
+  }
+  loaded.add_to_cache(100, "100");
+  if (loaded.get_value(1, value) || !loaded.get_value(0, value) || loaded.get_value(-1, value)) {
+    std::cerr << "Snapshot recency order was not restored" << std::endl;
+    return 3;
+  }
+
+  Cache smaller;
+  smaller.set_max_size(5);
+  if (smaller.load_snapshot(path, decode) != 5 || smaller.get_value(5, value) || !smaller.get_value(6, value) ||
+      !smaller.get_value(0, value)) {
+    std::cerr << "Snapshot did not keep the most recently used entries" << std::endl;
+    return 4;
+  }
+  std::ifstream tmp(std::string(path) + ".tmp");
+  if (tmp.is_open()) {
+    std::cerr << "Snapshot was not renamed into place" << std::endl;
+    return 7;
+  }
+  std::remove(path);
+
+  std::stringstream keysOnly;
+  saved.save_snapshot(keysOnly);
+  Cache fetched;
+  size_t count = fetched.load_snapshot(keysOnly, nullptr, [](const int& key, std::string& value) {
+    value = "fetched " + std::to_string(key);
+    return key != 3;
+  });
+  if (count != 9 || !fetched.get_value(4, value) || value != "fetched 4" || fetched.get_value(3, value)) {
+    std::cerr << "Keys-only snapshot was not fetched" << std::endl;
+    return 5;
+  }
+
+  std::stringstream garbage("not a snapshot");
+  if (fetched.load_snapshot(garbage) != 0) {
+    std::cerr << "Loaded a bad snapshot" << std::endl;
+    return 6;
+  }
+
+  // Layout: magic, save time, count, then key, ttl, flag, value length
+  Cache one;
+  one.add_to_cache(1, "one", std::chrono::seconds(1));
+  one.add_to_cache(2, "two");
+  std::stringstream snapshot;
+  one.save_snapshot(snapshot, encode);
+  std::string bytes = snapshot.str();
+  const size_t savedAtOffset = 8;
+  const size_t lengthOffset = 24 + sizeof(int) + 8 + 1;
+
+  // Saved two seconds ago: the entry with one second to live has expired
+  int64_t savedAt;
+  bytes.copy(reinterpret_cast<char*>(&savedAt), sizeof(savedAt), savedAtOffset);
+  savedAt -= 2000;
+  bytes.replace(savedAtOffset, sizeof(savedAt), reinterpret_cast<const char*>(&savedAt), sizeof(savedAt));
+  std::stringstream aged(bytes);
+  Cache restored;
+  if (restored.load_snapshot(aged, decode) != 1 || restored.get_value(1, value) || !restored.get_value(2, value)) {
+    std::cerr << "Snapshot ignored the time since it was saved" << std::endl;
+    return 8;
+  }
+
+  uint64_t huge = uint64_t(1) << 62;
+  bytes.replace(lengthOffset, sizeof(huge), reinterpret_cast<const char*>(&huge), sizeof(huge));
+  std::stringstream corrupt(bytes);
+  if (Cache().load_snapshot(corrupt, decode) != 0) {
+    std::cerr << "Loaded a value with a corrupt length" << std::endl;
+    return 9;
+  }
+  return 0;
+}
+
+/// @brief Checks that a sharded cache splits its capacity and reports
+///        sizes across shards
+/// @return 0 on success, unique error code on failure.
+int TestShardedCapacity()
+{
+  acl::ShardedLruCache<int, int> cache(5, 100);
+  if (cache.get_num_shards() != 8 || cache.get_max_size() != 100) {
+    std::cerr << "Got " << cache.get_num_shards() << " shards" << std::endl;
+    return 1;
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    cache.add_to_cache(i, i);
+  }
+  // Each of the 8 shards holds at most ceil(100 / 8) entries
+  if (cache.size() > 104 || cache.size() < 80) {
+    std::cerr << "Holding " << cache.size() << " entries for a capacity of 100" << std::endl;
+    return 2;
+  }
+
+  int value;
+  if (!cache.get_value(999, value) || value != 999) {
+    std::cerr << "Most recent entry missing" << std::endl;
+    return 3;
+  }
+
+  // An entry heavier than a shard's share of 100 but within the total
+  acl::ShardedLruCache<int, int> weighted(4);
+  weighted.setWeightFunction([](const int&, const int& v) { return static_cast<size_t>(v); });
+  weighted.set_max_weight(100);
+  for (int i = 0; i < 8; i++) {
+    weighted.add_to_cache(i, 5);
+  }
+  if (!weighted.add_to_cache(100, 40) || !weighted.get_value(100, value) || value != 40) {
+    std::cerr << "Refused an entry that fits the total weight capacity" << std::endl;
+    return 4;
+  }
+  if (weighted.add_to_cache(101, 101)) {
+    std::cerr << "Added an entry heavier than the whole cache" << std::endl;
+    return 5;
+  }
+  if (weighted.get_weight() > 100 + 40 - 25) {
+    std::cerr << "Weighs " << weighted.get_weight() << " for a capacity of 100" << std::endl;
+    return 6;
+  }
+  return 0;
+}
+
+/// @brief Checks that the shards of a ShardedLruCache clean up on one
+///        shared pool, and that it stops and restarts as a whole
+/// @return 0 on success, unique error code on failure.
+int TestShardedAsyncCleanup()
+{
+  std::atomic<int> calls(0);
+  acl::ShardedLruCache<int, int> cache(4, 8);
+  cache.setCleanupHandler([&calls](int, int) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    calls++;
+    return true;
+  });
+  if (!cache.startAsyncCleanup(1, 64) || cache.startAsyncCleanup()) {
+    std::cerr << "Async cleanup did not start exactly once" << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 40; i++) {
+    cache.add_to_cache(i, i);
+  }
+  // 32 evictions at 20 ms each would take 640 ms on this thread
+  if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(300)) {
+    std::cerr << "Inserts waited for the cleanup handler" << std::endl;
+    return 2;
+  }
+
+  cache.stopAsyncCleanup();
+  if (calls != 40 - static_cast<int>(cache.size())) {
+    std::cerr << "Async cleanup lost evictions: " << calls << " handler calls for "
+              << cache.size() << " entries left" << std::endl;
+    return 3;
+  }
+  if (!cache.startAsyncCleanup(2, 64)) {
+    std::cerr << "Async cleanup did not restart" << std::endl;
+    return 4;
+  }
+  return 0;
+}
+
+int main()
+{
+  int ret;
+  {
+    std::cout << "Testing LruCache..." << std::endl;
+    acl::LruCache<int, std::string> cache;
+    if ((ret = TestCacheSemantics(cache)) != 0) { return ret; }
+    acl::LruCache<int, int> ints;
+    if ((ret = TestCacheThreads(ints)) != 0) { return 10 + ret; }
+    if ((ret = TestAsyncCleanup<acl::LruCache<int, int>>()) != 0) { return 20 + ret; }
+    acl::LruCache<int, int> loaded;
+    if ((ret = TestGetOrLoad(loaded)) != 0) { return 30 + ret; }
+    if ((ret = TestLruCacheTtl()) != 0) { return 40 + ret; }
+    if ((ret = TestLruCacheRange()) != 0) { return 50 + ret; }
+    if ((ret = TestLruCacheSnapshot()) != 0) { return 60 + ret; }
+    acl::LruCache<int, std::string> weighted;
+    if ((ret = TestCacheWeights(weighted)) != 0) { return 70 + ret; }
+  }
+  {
+    std::cout << "Testing HashLruCache..." << std::endl;
+    acl::HashLruCache<int, std::string> cache;
+    if ((ret = TestCacheSemantics(cache)) != 0) { return 100 + ret; }
+    if ((ret = TestCacheWeights(cache)) != 0) { return 120 + ret; }
+    if ((ret = TestEvictionPolicies()) != 0) { return 130 + ret; }
+    if ((ret = TestClockRecency()) != 0) { return 140 + ret; }
+    if ((ret = TestAsyncCleanup<acl::HashLruCache<int, int>>()) != 0) { return 160 + ret; }
+    acl::HashLruCache<int, int> loaded;
+    if ((ret = TestGetOrLoad(loaded)) != 0) { return 170 + ret; }
+    acl::HashLruCache<int, int, std::hash<int>, acl::shared_mutex> clock;
+    clock.setClockRecency(true);
+    if ((ret = TestCacheThreads(clock)) != 0) { return 150 + ret; }
+    acl::HashLruCache<int, int> ints;
+    if ((ret = TestCacheThreads(ints)) != 0) { return 110 + ret; }
+  }
+  {
+    std::cout << "Testing ShardedLruCache..." << std::endl;
+    acl::ShardedLruCache<int, std::string> cache(1);
+    if ((ret = TestCacheSemantics(cache)) != 0) { return 200 + ret; }
+    if ((ret = TestCacheWeights(cache)) != 0) { return 230 + ret; }
+    acl::ShardedLruCache<int, int> ints(8);
+    if ((ret = TestCacheThreads(ints)) != 0) { return 210 + ret; }
+    if ((ret = TestShardedCapacity()) != 0) { return 220 + ret; }
+    acl::ShardedLruCache<int, int> loaded(4);
+    if ((ret = TestGetOrLoad(loaded)) != 0) { return 240 + ret; }
+    if ((ret = TestShardedAsyncCleanup()) != 0) { return 250 + ret; }
+  }
+
+  std::cout << "Success!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <TSMap.tcc>
+
+/// @brief Number of keys stored in each map
+static const int g_numKeys = 1000000;
+
+/// @brief Number of lookups timed per run
+static const size_t g_numLookups = 2000000;
+
+/// @brief TSMap ordered through a type-erased comparator, as TSMap used to be
+typedef acl::TSMap<int, int, std::function<bool(int,int)>> FunctionMap;
+
+/// @brief TSMap with the default, inlinable comparator
+typedef acl::TSMap<int, int> LessMap;
+
+/// @brief Fills a map with every even key in [0, 2 * g_numKeys)
+template<typename Map> void FillMap(Map& map)
+{
+  for (int i = 0; i < g_numKeys; i++) {
+    map.emplace(2 * i, i);
+  }
+}
+
+/// @brief Times find() or lower_bound() over a list of random keys.
+///        Odd keys miss in find() and land between entries in lower_bound().
+/// @return Lookups per second.
+template<typename Map> double BenchmarkLookups(const Map& map, const std::vector<int>& keys, bool lowerBound)
+{
+  size_t hits = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    if ((lowerBound ? map.lower_bound(keys[i]) : map.find(keys[i])).second) {
+      hits++;
+    }
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (!hits) {
+    std::cerr << "No lookups succeeded" << std::endl;
+  }
+  return keys.size() / elapsed.count();
+}
+
+int main()
+{
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(0, 2 * g_numKeys - 1);
+  std::vector<int> keys(g_numLookups);
+  std::generate(keys.begin(), keys.end(), [&] { return dist(rng); });
+
+  FunctionMap functionMap([](int k1, int k2)->bool { return k1 < k2; });
+  LessMap lessMap;
+  FillMap(functionMap);
+  FillMap(lessMap);
+
+  std::cout << std::fixed << std::setprecision(0);
+  std::cout << "TSMap with " << g_numKeys << " int keys, " << g_numLookups
+            << " random lookups (lookups/s)" << std::endl;
+  std::cout << std::setw(14) << "" << std::setw(16) << "std::function" << std::setw(16) << "std::less" << std::endl;
+  std::cout << std::setw(14) << "find"
+            << std::setw(16) << BenchmarkLookups(functionMap, keys, false)
+            << std::setw(16) << BenchmarkLookups(lessMap, keys, false) << std::endl;
+  std::cout << std::setw(14) << "lower_bound"
+            << std::setw(16) << BenchmarkLookups(functionMap, keys, true)
+            << std::setw(16) << BenchmarkLookups(lessMap, keys, true) << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,416 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <RCUMap.tcc>
+#include <TSHashMap.tcc>
+#include <TSMap.tcc>
+
+/// @brief Value type that counts how often it is copied
+struct CopyCounter
+{
+  static int copies;
+  std::vector<char> payload;
+
+  CopyCounter() : payload(4096) {}
+  CopyCounter(const CopyCounter& other) : payload(other.payload) { copies++; }
+  CopyCounter(CopyCounter&&) = default;
+  CopyCounter& operator=(const CopyCounter& other) { payload = other.payload; copies++; return *this; }
+  CopyCounter& operator=(CopyCounter&&) = default;
+};
+int CopyCounter::copies = 0;
+
+/// @brief Checks that the TSMap read guard and visitors never copy values
+/// @return 0 on success, unique error code on failure.
+int TestMapZeroCopy()
+{
+  acl::TSMap<int, CopyCounter> map;
+  for (int i = 0; i < 10; i += 2) {
+    map.createInPlace(i);
+  }
+  CopyCounter::copies = 0;
+
+  {
+    auto guard = map.read(4);
+    if (!guard || guard.key() != 4 || guard->payload.size() != 4096) {
+      std::cerr << "read did not find key 4" << std::endl;
+      return 1;
+    }
+    if (map.read(5)) {
+      std::cerr << "read found a missing key" << std::endl;
+      return 2;
+    }
+  }
+
+  // The guard must have dropped its lock so writers can proceed
+  if (!map.erase(4)) {
+    std::cerr << "erase failed after the guard was released" << std::endl;
+    return 3;
+  }
+
+  int key = -1;
+  auto record = [&key](const int& k, const CopyCounter&) { key = k; };
+  if (!map.visit(2, record) || key != 2 || map.visit(4, record)) {
+    std::cerr << "visit returned the wrong entry" << std::endl;
+    return 4;
+  }
+  if (!map.visit_lower_bound(3, record) || key != 6) {
+    std::cerr << "visit_lower_bound returned " << key << std::endl;
+    return 5;
+  }
+  if (!map.visit_infimum(5, record) || key != 2 || map.visit_infimum(-1, record)) {
+    std::cerr << "visit_infimum returned " << key << std::endl;
+    return 6;
+  }
+
+  size_t total = 0;
+  map.for_each_ro([&total](const int&, const CopyCounter& v) { total += v.payload.size(); return true; });
+  map.perform_ro(0, [](const int&, const CopyCounter& v) { return !v.payload.empty(); });
+  if (total != 4 * 4096) {
+    std::cerr << "for_each_ro saw " << total << " bytes" << std::endl;
+    return 7;
+  }
+
+  if (!map.remove(8).second) {
+    std::cerr << "remove failed" << std::endl;
+    return 8;
+  }
+
+  if (CopyCounter::copies != 0) {
+    std::cerr << "Reads copied " << CopyCounter::copies << " values" << std::endl;
+    return 9;
+  }
+  return 0;
+}
+
+/// @brief Orders strings ignoring case
+struct CaseInsensitiveLess
+{
+  bool operator()(const std::string& a, const std::string& b) const
+  {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+      return std::tolower((unsigned char)x) < std::tolower((unsigned char)y);
+    });
+  }
+};
+
+/// @brief Checks the ordered queries of TSMap with the default and with
+///        custom comparators
+/// @return 0 on success, unique error code on failure.
+int TestMapComparator()
+{
+  acl::TSMap<int, int> ascending;
+  acl::TSMap<int, int, std::greater<int>> descending;
+  for (int i = 10; i <= 30; i += 10) {
+    ascending.emplace(i, i);
+    descending.emplace(i, i);
+  }
+
+  if (ascending.findInfimum(25).first != 20 || ascending.findInfimum(20).first != 20 ||
+      ascending.findInfimum(35).first != 30 || ascending.findInfimum(5).second ||
+      ascending.findInfimum_key(25).first.first != 20 || ascending.lower_bound(25).first != 30 ||
+      ascending.lower_bound(35).second) {
+    std::cerr << "Ordered queries failed with std::less" << std::endl;
+    return 1;
+  }
+
+  // Keys run 30, 20, 10, so lower_bound and findInfimum swap directions
+  if (descending.getKeyList() != std::vector<int>({30, 20, 10}) || descending.lower_bound(25).first != 20 ||
+      descending.findInfimum(25).first != 30 || descending.findInfimum(20).first != 20 ||
+      descending.findInfimum(5).first != 10 || descending.findInfimum(35).second ||
+      descending.findInfimum_key(15).first.first != 20 || descending.lower_bound(5).second) {
+    std::cerr << "Ordered queries failed with std::greater" << std::endl;
+    return 2;
+  }
+
+  acl::TSMap<std::string, int, CaseInsensitiveLess> names{CaseInsensitiveLess()};
+  names.emplace("Camera", 1);
+  if (names.emplace("CAMERA", 2) || !names.find("camera").second || names.find("camera").first != 1 ||
+      names.findInfimum("CAMERAS").first != 1) {
+    std::cerr << "Lookups failed with a case-insensitive comparator" << std::endl;
+    return 3;
+  }
+  return 0;
+}
+
+/// @brief Applies the same random operations to a TSHashMap and a std::map
+///        and checks that they agree.  Few shards and small tables force
+///        growth and probe wrap-around.
+/// @return 0 on success, unique error code on failure.
+int TestHashMapSemantics()
+{
+  acl::TSHashMap<int, std::string> map(2);
+  std::map<int, std::string> ref;
+  std::mt19937 rng(42);
+
+  for (int i = 0; i < 20000; i++) {
+    int key = rng() % 500;
+    std::string value = std::to_string(i);
+
+    switch (rng() % 4) {
+      case 0:
+        if (map.emplace(key, value) != ref.emplace(key, value).second) {
+          std::cerr << "emplace disagreed on key " << key << std::endl;
+          return 1;
+        }
+        break;
+      case 1: {
+        auto old = map.replace(key, value);
+        bool existed = ref.count(key) != 0;
+        if (old.second == existed || (existed && old.first != ref[key])) {
+          std::cerr << "replace disagreed on key " << key << std::endl;
+          return 2;
+        }
+        ref[key] = value;
+        break;
+      }
+      case 2:
+        if (map.erase(key) != (ref.erase(key) != 0)) {
+          std::cerr << "erase disagreed on key " << key << std::endl;
+          return 3;
+        }
+        break;
+      default: {
+        auto found = map.find(key);
+        auto it = ref.find(key);
+        if (found.second != (it != ref.end()) || (found.second && found.first != it->second)) {
+          std::cerr << "find disagreed on key " << key << std::endl;
+          return 4;
+        }
+      }
+    }
+  }
+
+  if (map.size() != ref.size() || map.getKeyList().size() != ref.size()) {
+    std::cerr << "Size " << map.size() << " expected " << ref.size() << std::endl;
+    return 5;
+  }
+
+  // Every entry must still be reachable after the backward shift deletes
+  for (auto& kv : ref) {
+    if (!map.perform_ro(kv.first, [&kv](int, const std::string& v) { return v == kv.second; })) {
+      std::cerr << "Lost key " << kv.first << std::endl;
+      return 6;
+    }
+  }
+
+  size_t odd = map.delete_if([](int k, std::string&) { return k % 2 != 0; });
+  size_t expected = 0;
+  for (auto& kv : ref) {
+    expected += kv.first % 2 != 0;
+  }
+  if (odd != expected || map.for_each_ro([](int k, const std::string&) { return k % 2 == 0; }) != map.size()) {
+    std::cerr << "delete_if removed " << odd << " of " << expected << std::endl;
+    return 7;
+  }
+
+  auto removed = map.remove(0);
+  if (ref.count(0) && (!removed.second || removed.first != ref[0])) {
+    std::cerr << "remove failed" << std::endl;
+    return 8;
+  }
+
+  map.clear();
+  if (!map.empty() || map.find(2).second) {
+    std::cerr << "clear left entries" << std::endl;
+    return 9;
+  }
+  return 0;
+}
+
+/// @brief Checks that delete_if calls its predicate exactly once per entry,
+///        including when erasing shifts a probe run that wraps around the
+///        end of the table.  One shard of 8 slots makes wrap-around common.
+/// @return 0 on success, unique error code on failure.
+int TestHashMapDeleteIfOnce()
+{
+  std::mt19937 rng(7);
+
+  for (int trial = 0; trial < 2000; trial++) {
+    acl::TSHashMap<int, int> map(1);
+    std::map<int, int> calls;
+    for (int i = 0; i < 5; i++) {
+      map.emplace(rng() % 1000, 0);
+    }
+    size_t size = map.size();
+
+    size_t erased = map.delete_if([&calls](int k, int& v) {
+      v++;
+      calls[k]++;
+      return k % 2 == 0;
+    });
+
+    size_t even = 0;
+    for (auto& kv : calls) {
+      if (kv.second != 1) {
+        std::cerr << "delete_if visited key " << kv.first << " " << kv.second << " times" << std::endl;
+        return 1;
+      }
+      even += kv.first % 2 == 0;
+    }
+    if (calls.size() != size || erased != even || map.size() != size - even) {
+      std::cerr << "delete_if visited " << calls.size() << " of " << size << " entries" << std::endl;
+      return 2;
+    }
+    if (map.for_each_ro([](int, const int& v) { return v == 1; }) != map.size()) {
+      std::cerr << "delete_if ran the predicate twice on a kept entry" << std::endl;
+      return 3;
+    }
+  }
+  return 0;
+}
+
+/// @brief Hammers a TSHashMap from several writers with disjoint keys
+/// @return 0 on success, unique error code on failure.
+int TestHashMapThreads()
+{
+  const int threads = 4;
+  const int perThread = 20000;
+  acl::TSHashMap<int, int> map;
+  std::vector<std::thread> workers;
+
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&map, t, perThread] {
+      for (int i = 0; i < perThread; i++) {
+        map.emplace(t * perThread + i, i);
+        map.perform(t * perThread + i, [](int, int& v) { v++; return true; });
+        if (i % 2) {
+          map.erase(t * perThread + i);
+        }
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  if (map.size() != threads * perThread / 2) {
+    std::cerr << "Expected " << threads * perThread / 2 << " entries, got " << map.size() << std::endl;
+    return 1;
+  }
+  for (int k = 0; k < threads * perThread; k += 2) {
+    auto found = map.find(k);
+    if (!found.second || found.first != k % perThread + 1) {
+      std::cerr << "Bad value for key " << k << std::endl;
+      return 2;
+    }
+  }
+  return 0;
+}
+
+/// @brief Checks RCUMap writes and that readers running alongside a writer
+///        always see a complete, consistent snapshot.
+/// @return 0 on success, unique error code on failure.
+int TestRCUMap()
+{
+  acl::RCUMap<int, int> map;
+
+  if (!map.emplace(1, 10) || map.emplace(1, 11) || map.find(1).first != 10) {
+    std::cerr << "emplace failed" << std::endl;
+    return 1;
+  }
+  auto old = map.replace(1, 12);
+  if (old.second || old.first != 10 || map.find(1).first != 12 || !map.replace(2, 20).second) {
+    std::cerr << "replace failed" << std::endl;
+    return 2;
+  }
+  {
+    // A snapshot keeps its version while a writer publishes a new one.
+    // The writer cannot free the old version until the snapshot is released.
+    auto snap = map.snapshot();
+    std::thread writer([&map] { map.erase(1); });
+    while (map.find(1).second) {
+      std::this_thread::yield();
+    }
+    bool intact = snap->size() == 2 && snap->count(1) == 1;
+    snap.release();
+    writer.join();
+    if (!intact || map.size() != 1) {
+      std::cerr << "snapshot changed under a reader" << std::endl;
+      return 3;
+    }
+  }
+
+  // Writer keeps every value equal to the version number in one batch;
+  // readers must never see a mix of versions
+  const int keys = 64;
+  const int versions = 200;
+  std::atomic_bool done(false);
+  std::atomic_int torn(0);
+  std::vector<std::thread> readers;
+
+  map.update([keys](std::map<int, int>& m) {
+    m.clear();
+    for (int k = 0; k < keys; k++) {
+      m[k] = 0;
+    }
+  });
+
+  for (int r = 0; r < 4; r++) {
+    readers.emplace_back([&map, &done, &torn] {
+      while (!done) {
+        auto snap = map.snapshot();
+        int first = snap->begin()->second;
+        for (auto& kv : *snap) {
+          if (kv.second != first) {
+            torn++;
+          }
+        }
+      }
+    });
+  }
+  for (int v = 1; v <= versions; v++) {
+    map.update([v](std::map<int, int>& m) {
+      for (auto& kv : m) {
+        kv.second = v;
+      }
+    });
+  }
+  done = true;
+  for (auto& r : readers) {
+    r.join();
+  }
+
+  if (torn != 0 || map.find(keys - 1).first != versions) {
+    std::cerr << "Readers saw " << torn << " torn snapshots" << std::endl;
+    return 4;
+  }
+
+  map.clear();
+  if (!map.empty()) {
+    std::cerr << "clear left entries" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+int main()
+{
+  int ret;
+
+  std::cout << "Testing TSMap..." << std::endl;
+  if ((ret = TestMapZeroCopy()) != 0) { return 100 + ret; }
+  if ((ret = TestMapComparator()) != 0) { return 120 + ret; }
+
+  std::cout << "Testing RCUMap..." << std::endl;
+  if ((ret = TestRCUMap()) != 0) { return 150 + ret; }
+
+  std::cout << "Testing TSHashMap..." << std::endl;
+  if ((ret = TestHashMapSemantics()) != 0) { return ret; }
+  if ((ret = TestHashMapThreads()) != 0) { return 20 + ret; }
+  if ((ret = TestHashMapDeleteIfOnce()) != 0) { return 40 + ret; }
+
+  std::cout << "Success!" << std::endl;
+  return 0;
+}
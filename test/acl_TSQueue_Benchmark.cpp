@@ -0,0 +1,240 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <TSQueue.tcc>
+#include <TSRingQueue.tcc>
+#include <SPSCQueue.tcc>
+
+/// @brief Total number of elements moved through the queue per run
+static const size_t g_numItems = 1600000;
+
+/// @brief Maximum queue length used for every run
+static const size_t g_queueSize = 1024;
+
+/// @brief Moves g_numItems through a queue from producers to one consumer.
+/// @param [in] q Queue to test, must be empty
+/// @param [in] producers Number of producer threads
+/// @return Elements per second, or a negative number if elements were lost.
+double BenchmarkQueue(acl::TSQueue<uint64_t>& q, size_t producers)
+{
+  size_t perProducer = g_numItems / producers;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&q, perProducer] {
+      for (size_t i = 0; i < perProducer; i++) {
+        while (!q.enqueue(i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  uint64_t value;
+  size_t received = 0;
+  while (received < perProducer * producers && q.dequeue(value, 1000)) {
+    received++;
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (received != perProducer * producers) {
+    return -1;
+  }
+  return received / elapsed.count();
+}
+
+/// @brief Moves g_numItems from one producer to one consumer through an SPSCQueue.
+/// @return Elements per second, or a negative number if elements were lost.
+double BenchmarkSPSCQueue()
+{
+  acl::SPSCQueue<uint64_t> q(g_queueSize);
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread producer([&q] {
+    for (size_t i = 0; i < g_numItems; i++) {
+      while (!q.enqueue(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint64_t value;
+  size_t received = 0;
+  while (received < g_numItems && q.dequeue(value, 1000)) {
+    received++;
+  }
+  producer.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (received != g_numItems) {
+    return -1;
+  }
+  return received / elapsed.count();
+}
+
+/// @brief Moves g_numItems from one producer to one consumer in bursts.
+/// @param [in] q Queue to test, must be empty
+/// @param [in] burst Number of elements per burst
+/// @param [in] bulk Use enqueue_bulk/dequeue_bulk instead of per-element calls
+/// @return Nanoseconds per element, or a negative number if elements were lost.
+double BenchmarkBursts(acl::TSQueue<uint64_t>& q, size_t burst, bool bulk)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  std::thread producer([&q, burst, bulk] {
+    std::vector<uint64_t> packets(burst);
+    for (size_t sent = 0; sent < g_numItems; sent += burst) {
+      if (bulk) {
+        size_t done = 0;
+        while (done < burst) {
+          done += q.enqueue_bulk(packets.begin() + done, packets.end());
+          if (done < burst) {
+            std::this_thread::yield();
+          }
+        }
+      } else {
+        for (auto& p : packets) {
+          while (!q.enqueue(p)) {
+            std::this_thread::yield();
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<uint64_t> packets(burst);
+  size_t received = 0;
+  while (received < g_numItems) {
+    size_t count = 0;
+    if (bulk) {
+      count = q.dequeue_bulk(packets.begin(), burst, 1000);
+    } else {
+      while (count < burst && q.dequeue(packets[count], count ? 0 : 1000)) {
+        count++;
+      }
+    }
+    if (!count) {
+      break;
+    }
+    received += count;
+  }
+  producer.join();
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  if (received != g_numItems) {
+    return -1;
+  }
+  return elapsed.count() / received;
+}
+
+/// @brief Measures the raw cost of the lock and signal each queue operation pays.
+/// @tparam Mutex The mutex type
+/// @tparam CondVar The condition variable type used with Mutex
+/// @return Nanoseconds per lock/notify/unlock cycle.
+template<typename Mutex, typename CondVar> double BenchmarkLockNotify()
+{
+  Mutex m;
+  CondVar cv;
+  const size_t cycles = 10000000;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < cycles; i++) {
+    std::unique_lock<Mutex> lock(m);
+    cv.notify_one();
+  }
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / cycles;
+}
+
+/// @brief Measures an uncontended enqueue/dequeue pair on a single thread.
+/// @return Nanoseconds per enqueue/dequeue pair.
+double BenchmarkUncontended()
+{
+  acl::TSRingQueue<uint64_t> q(g_queueSize);
+  uint64_t value = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < g_numItems; i++) {
+    q.enqueue(i);
+    q.dequeue(value);
+  }
+
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return value + 1 == g_numItems ? elapsed.count() / g_numItems : -1;
+}
+
+int main()
+{
+  std::cout << std::setw(10) << "producers"
+            << std::setw(16) << "TSQueue"
+            << std::setw(16) << "TSRingQueue"
+            << "   (ops/sec, one consumer)" << std::endl;
+
+  for (size_t producers : {1, 4, 16}) {
+    acl::TSQueue<uint64_t> list;
+    list.set_max_size(g_queueSize);
+    acl::TSRingQueue<uint64_t> ring(g_queueSize);
+
+    double listRate = BenchmarkQueue(list, producers);
+    double ringRate = BenchmarkQueue(ring, producers);
+    if (listRate < 0 || ringRate < 0) {
+      std::cerr << "Elements were lost with " << producers << " producers" << std::endl;
+      return 1;
+    }
+
+    std::cout << std::setw(10) << producers
+              << std::setw(16) << std::fixed << std::setprecision(0) << listRate
+              << std::setw(16) << ringRate << std::endl;
+  }
+
+  double spscRate = BenchmarkSPSCQueue();
+  if (spscRate < 0) {
+    std::cerr << "Elements were lost through SPSCQueue" << std::endl;
+    return 1;
+  }
+  std::cout << std::endl << "SPSCQueue, one producer and one consumer: "
+            << spscRate << " ops/sec" << std::endl;
+
+  std::cout << std::endl
+            << std::setw(10) << "burst"
+            << std::setw(16) << "loop"
+            << std::setw(16) << "bulk"
+            << "   (ns/element, TSQueue max size " << g_queueSize << ")" << std::endl;
+  for (size_t burst : {64, 256}) {
+    acl::TSQueue<uint64_t> loopQueue;
+    loopQueue.set_max_size(g_queueSize);
+    acl::TSQueue<uint64_t> bulkQueue;
+    bulkQueue.set_max_size(g_queueSize);
+
+    double loopCost = BenchmarkBursts(loopQueue, burst, false);
+    double bulkCost = BenchmarkBursts(bulkQueue, burst, true);
+    if (loopCost < 0 || bulkCost < 0) {
+      std::cerr << "Elements were lost with bursts of " << burst << std::endl;
+      return 1;
+    }
+    std::cout << std::setw(10) << burst
+              << std::setw(16) << std::setprecision(1) << loopCost
+              << std::setw(16) << bulkCost << std::endl;
+  }
+
+  std::cout << std::endl << "lock + notify_one + unlock:" << std::endl
+            << "  recursive_mutex/condition_variable_any: "
+            << BenchmarkLockNotify<std::recursive_mutex, std::condition_variable_any>() << " ns" << std::endl
+            << "  mutex/condition_variable:               "
+            << BenchmarkLockNotify<std::mutex, std::condition_variable>() << " ns" << std::endl;
+  std::cout << "Uncontended TSRingQueue enqueue+dequeue: " << BenchmarkUncontended() << " ns" << std::endl;
+  return 0;
+}
@@ -0,0 +1,503 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <TSQueue.tcc>
+#include <TSRingQueue.tcc>
+#include <SPSCQueue.tcc>
+#include <TSPriorityQueue.tcc>
+#include <MPMCQueue.tcc>
+#include <ThreadPool.h>
+
+/// @brief Checks FIFO, stack, peek and max size behavior of a queue.
+/// @param [in] q Queue to test, must be empty with a max size of 4
+/// @return 0 on success, unique error code on failure.
+int TestQueueSemantics(acl::TSQueue<int>& q)
+{
+  int value = -1;
+  if (q.dequeue(value) || q.peek(value)) {
+    std::cerr << "Dequeued from an empty queue" << std::endl;
+    return 1;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    if (!q.enqueue(i)) {
+      std::cerr << "Failed to enqueue " << i << std::endl;
+      return 2;
+    }
+  }
+  if (q.enqueue(4)) {
+    std::cerr << "Enqueued past the max size" << std::endl;
+    return 3;
+  }
+  if (!q.enqueue(4, true) || q.size() != 5) {
+    std::cerr << "Forced enqueue failed" << std::endl;
+    return 4;
+  }
+  if (!q.peek(value) || value != 0) {
+    std::cerr << "Peek returned " << value << std::endl;
+    return 5;
+  }
+
+  // Wrap around the end of the storage a few times
+  for (int i = 5; i < 50; i++) {
+    if (!q.dequeue(value) || value != i - 5) {
+      std::cerr << "Expected " << i - 5 << " got " << value << std::endl;
+      return 6;
+    }
+    q.enqueue(i, true);
+  }
+
+  q.delete_all();
+  if (q.size() != 0 || !q.wait_until_empty(1)) {
+    std::cerr << "delete_all left " << q.size() << " elements" << std::endl;
+    return 7;
+  }
+
+  std::vector<int> in = {0, 1, 2, 3, 4, 5};
+  std::vector<int> out;
+  if (q.enqueue_bulk(in.begin(), in.end()) != 4 ||
+      q.dequeue_bulk(std::back_inserter(out), 3) != 3 ||
+      q.dequeue_bulk(std::back_inserter(out), 3) != 1 ||
+      q.dequeue_bulk(std::back_inserter(out), 3, 1) != 0 ||
+      out != std::vector<int>({0, 1, 2, 3})) {
+    std::cerr << "Bulk enqueue/dequeue mismatch" << std::endl;
+    return 9;
+  }
+
+  q.enqueue(1);
+  q.push(0);
+  for (int i = 0; i < 2; i++) {
+    if (!q.pop(value) || value != i) {
+      std::cerr << "Stack order wrong, expected " << i << " got " << value << std::endl;
+      return 8;
+    }
+  }
+  return 0;
+}
+
+/// @brief Runs producers against a single consumer and checks nothing is lost.
+/// @param [in] q Queue to test, must be empty
+/// @param [in] producers Number of producer threads
+/// @return 0 on success, unique error code on failure.
+int TestQueueThreads(acl::TSQueue<int>& q, int producers)
+{
+  const int perProducer = 10000;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&q, p] {
+      for (int i = 0; i < perProducer; i++) {
+        while (!q.enqueue(p * perProducer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> lastSeen(producers, -1);
+  int value;
+  for (int i = 0; i < producers * perProducer; i++) {
+    if (!q.dequeue(value, 1000)) {
+      std::cerr << "Timed out after " << i << " elements" << std::endl;
+      for (auto& t : threads) { t.join(); }
+      return 20;
+    }
+    int p = value / perProducer;
+    if (value % perProducer <= lastSeen[p]) {
+      std::cerr << "Producer " << p << " reordered" << std::endl;
+      for (auto& t : threads) { t.join(); }
+      return 21;
+    }
+    lastSeen[p] = value % perProducer;
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+  return q.size() == 0 ? 0 : 22;
+}
+
+/// @brief Checks SPSCQueue bounds and ordering, including a consumer that has
+/// to sleep waiting for a slow producer.
+/// @return 0 on success, unique error code on failure.
+int TestSPSCQueue()
+{
+  acl::SPSCQueue<int> q(3);
+  int value = -1;
+  if (q.dequeue(value) || q.dequeue(value, 1)) {
+    std::cerr << "Dequeued from an empty queue" << std::endl;
+    return 1;
+  }
+  for (int i = 0; i < 3; i++) {
+    q.enqueue(i);
+  }
+  if (q.enqueue(3) || q.size() != 3 || q.get_max_size() != 3) {
+    std::cerr << "Enqueued past the max size" << std::endl;
+    return 2;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!q.dequeue(value) || value != i) {
+      std::cerr << "Expected " << i << " got " << value << std::endl;
+      return 3;
+    }
+  }
+
+  const int count = 100000;
+  std::thread producer([&q] {
+    for (int i = 0; i < count; i++) {
+      while (!q.enqueue(i)) {
+        std::this_thread::yield();
+      }
+      // Periodically stall so the consumer goes to sleep
+      if (i % 10000 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    }
+  });
+
+  int ret = 0;
+  for (int i = 0; i < count; i++) {
+    if (!q.dequeue(value, 1000) || value != i) {
+      std::cerr << "Expected " << i << " got " << value << std::endl;
+      ret = 4;
+      break;
+    }
+  }
+  producer.join();
+  return ret;
+}
+
+/// @brief Runs several producers and consumers through an MPMCQueue and
+/// checks every element comes out exactly once.
+/// @return 0 on success, unique error code on failure.
+int TestMPMCQueue()
+{
+  acl::MPMCQueue<int> q(100);
+  if (q.get_max_size() != 128) {
+    std::cerr << "Max size not rounded to a power of 2" << std::endl;
+    return 1;
+  }
+
+  const int producers = 4;
+  const int consumers = 4;
+  const int perProducer = 20000;
+  std::atomic<long long> sum(0);
+  std::atomic_int received(0);
+  std::vector<std::thread> threads;
+
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&] {
+      int value;
+      while (received < producers * perProducer) {
+        if (q.dequeue(value, 10)) {
+          sum += value;
+          received++;
+        }
+      }
+    });
+  }
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&q] {
+      for (int i = 1; i <= perProducer; i++) {
+        while (!q.enqueue(i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  long long expected = (long long)producers * perProducer * (perProducer + 1) / 2;
+  if (sum != expected || q.size() != 0 || !q.wait_until_empty(1)) {
+    std::cerr << "Sum " << sum << " expected " << expected << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+/// @brief Checks that TSPriorityQueue dequeues by band, then by age.
+/// @return 0 on success, unique error code on failure.
+int TestPriorityQueue()
+{
+  acl::TSPriorityQueue<int> q(3);
+  q.enqueue(10);
+  q.enqueue(20, 1);
+  q.enqueue(30, 2);
+  q.enqueue(21, 1);
+  q.enqueue(31, 99);
+  q.enqueue(11, -5);
+  q.push(40);
+
+  std::vector<int> expected = {40, 30, 31, 20, 21, 10, 11};
+  int value;
+  if (!q.peek(value) || value != 40) {
+    std::cerr << "Peek returned " << value << std::endl;
+    return 1;
+  }
+  for (int e : expected) {
+    if (!q.dequeue(value) || value != e) {
+      std::cerr << "Expected " << e << " got " << value << std::endl;
+      return 2;
+    }
+  }
+  return q.size() == 0 ? 0 : 3;
+}
+
+/// @brief Checks that ThreadPool runs high priority jobs ahead of queued ones.
+/// @return 0 on success, unique error code on failure.
+int TestThreadPoolPriority()
+{
+  acl::ThreadPool pool(1, 256, 10);
+  std::mutex orderMutex;
+  std::vector<int> order;
+  std::mutex gate;
+  gate.lock();
+
+  // Occupy the only worker until everything is queued
+  pool.push_job([&gate] {std::lock_guard<std::mutex> l(gate);});
+  pool.Start();
+  while (pool.size()) {
+    std::this_thread::yield();
+  }
+
+  for (int i = 0; i < 10; i++) {
+    pool.push_job([&, i] {std::lock_guard<std::mutex> l(orderMutex); order.push_back(i);});
+  }
+  pool.push_job([&] {std::lock_guard<std::mutex> l(orderMutex); order.push_back(100);}, 5);
+  gate.unlock();
+
+  pool.wait_until_empty(5000);
+  pool.Stop();
+  pool.Join();
+
+  if (order.size() != 11 || order[0] != 100) {
+    std::cerr << "Priority job did not run first" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// @brief Runs jobs through a ThreadPool and waits for all of them.
+/// @param [in] lockFree Whether the pool uses the lock-free job queue
+/// @return 0 on success, unique error code on failure.
+int TestThreadPool(bool lockFree)
+{
+  const int jobs = 10000;
+  std::atomic_int done(0);
+  acl::ThreadPool pool(4, 256, 10, lockFree);
+  if (pool.set_max_size(256) == lockFree) {
+    std::cerr << "set_max_size did not report whether it applied" << std::endl;
+    return 3;
+  }
+  pool.Start();
+
+  for (int i = 0; i < jobs; i++) {
+    while (!pool.push_job([&done] {done++;})) {
+      std::this_thread::yield();
+    }
+  }
+  if (!pool.wait_until_empty(5000)) {
+    std::cerr << "Job queue never emptied" << std::endl;
+    return 1;
+  }
+  pool.Stop();
+  pool.Join();
+
+  if (done != jobs) {
+    std::cerr << "Ran " << done << " of " << jobs << " jobs" << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+/// @brief Checks the std::chrono, deadline and wait_forever overloads.
+/// @return 0 on success, unique error code on failure.
+int TestQueueWaits()
+{
+  acl::TSQueue<int> q;
+  int value = 0;
+  auto start = std::chrono::steady_clock::now();
+  if (q.dequeue(value, std::chrono::microseconds(500)) ||
+      q.peek(value, start + std::chrono::milliseconds(2)) ||
+      q.pop(value, std::chrono::duration<double>(0.001))) {
+    std::cerr << "Timed wait returned data from an empty queue" << std::endl;
+    return 1;
+  }
+  if (std::chrono::steady_clock::now() - start > std::chrono::seconds(1)) {
+    std::cerr << "Timed waits took too long" << std::endl;
+    return 2;
+  }
+
+  std::thread producer([&q] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.enqueue(5);
+  });
+  bool rc = q.dequeue(value, acl::wait_forever);
+  producer.join();
+  if (!rc || value != 5 || !q.wait_until_empty(acl::wait_forever)) {
+    std::cerr << "wait_forever did not return the element" << std::endl;
+    return 3;
+  }
+
+  std::thread canceller([&q] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.cancel_waits();
+  });
+  rc = q.dequeue(value, acl::wait_forever);
+  canceller.join();
+  if (rc || q.peek(value, acl::wait_forever)) {
+    std::cerr << "cancel_waits did not release the consumer" << std::endl;
+    return 4;
+  }
+
+  q.resume_waits();
+  q.enqueue(6);
+  std::vector<int> out;
+  if (q.dequeue_bulk(std::back_inserter(out), 4, acl::wait_forever) != 1 ||
+      q.dequeue_bulk(std::back_inserter(out), 4, std::chrono::microseconds(100)) != 0) {
+    std::cerr << "dequeue_bulk waits failed" << std::endl;
+    return 5;
+  }
+  return 0;
+}
+
+/// @brief Checks that buffers moved through a queue are never copied.
+/// @param [in] q Queue to test, must be empty
+/// @return 0 on success, unique error code on failure.
+int TestQueueMoves(acl::TSQueue<std::vector<uint8_t>>& q)
+{
+  std::vector<uint8_t> buffer(1 << 20, 7);
+  const uint8_t* data = buffer.data();
+  std::vector<uint8_t> out;
+
+  if (!q.enqueue(std::move(buffer)) || !q.dequeue(out) || out.data() != data) {
+    std::cerr << "enqueue(T&&)/dequeue copied the buffer" << std::endl;
+    return 1;
+  }
+  if (!q.emplace(16, 3) || !q.dequeue(out) || out.size() != 16 || out[15] != 3) {
+    std::cerr << "emplace constructed the wrong element" << std::endl;
+    return 2;
+  }
+
+  data = out.data();
+  std::vector<std::vector<uint8_t>> burst;
+  burst.push_back(std::move(out));
+  if (!q.enqueue(std::move(burst[0])) ||
+      q.dequeue_bulk(burst.begin(), 1) != 1 || burst[0].data() != data) {
+    std::cerr << "dequeue_bulk copied the buffer" << std::endl;
+    return 3;
+  }
+  return 0;
+}
+
+/// @brief Element whose assignments throw on demand
+struct FlakyElement {
+  static bool fail;
+  int value = 0;
+
+  FlakyElement() {}
+  FlakyElement(int v): value(v) {}
+  FlakyElement(const FlakyElement& other) = default;
+  FlakyElement& operator=(const FlakyElement& other)
+  {
+    if (fail) {
+      throw std::runtime_error("assignment failed");
+    }
+    value = other.value;
+    return *this;
+  }
+  FlakyElement& operator=(FlakyElement&& other)
+  {
+    return *this = static_cast<const FlakyElement&>(other);
+  }
+};
+bool FlakyElement::fail = false;
+
+/// @brief Checks that an element whose assignment throws is not counted
+///        by a TSRingQueue, at either end.
+/// @return 0 on success, unique error code on failure.
+int TestRingQueueThrowingStore()
+{
+  acl::TSRingQueue<FlakyElement> q(4);
+  q.enqueue(FlakyElement(1));
+
+  FlakyElement::fail = true;
+  int thrown = 0;
+  try {
+    q.enqueue(FlakyElement(2));
+  } catch (const std::runtime_error&) {
+    thrown++;
+  }
+  try {
+    q.push(FlakyElement(3));
+  } catch (const std::runtime_error&) {
+    thrown++;
+  }
+  FlakyElement::fail = false;
+
+  FlakyElement out;
+  if (thrown != 2 || q.size() != 1 || !q.dequeue(out) || out.value != 1 || q.size() != 0) {
+    std::cerr << "A failed store left " << q.size() << " elements counted" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int main()
+{
+  int ret;
+  {
+    std::cout << "Testing TSQueue..." << std::endl;
+    acl::TSQueue<int> q;
+    q.set_max_size(4);
+    if ((ret = TestQueueSemantics(q)) != 0) { return ret; }
+    q.set_max_size(64);
+    if ((ret = TestQueueThreads(q, 4)) != 0) { return ret; }
+
+    acl::TSQueue<std::vector<uint8_t>> buffers;
+    if ((ret = TestQueueMoves(buffers)) != 0) { return 50 + ret; }
+    if ((ret = TestQueueWaits()) != 0) { return 60 + ret; }
+  }
+  {
+    std::cout << "Testing TSRingQueue..." << std::endl;
+    acl::TSRingQueue<int> q(4);
+    if ((ret = TestQueueSemantics(q)) != 0) { return 100 + ret; }
+    q.set_max_size(64);
+    if (q.capacity() < 64) {
+      std::cerr << "set_max_size did not preallocate" << std::endl;
+      return 130;
+    }
+    if ((ret = TestQueueThreads(q, 4)) != 0) { return 100 + ret; }
+
+    acl::TSRingQueue<std::vector<uint8_t>> buffers(4);
+    if ((ret = TestQueueMoves(buffers)) != 0) { return 150 + ret; }
+    if ((ret = TestRingQueueThrowingStore()) != 0) { return 160 + ret; }
+  }
+
+  std::cout << "Testing SPSCQueue..." << std::endl;
+  if ((ret = TestSPSCQueue()) != 0) { return 200 + ret; }
+
+  std::cout << "Testing TSPriorityQueue..." << std::endl;
+  if ((ret = TestPriorityQueue()) != 0) { return 250 + ret; }
+
+  std::cout << "Testing MPMCQueue..." << std::endl;
+  if ((ret = TestMPMCQueue()) != 0) { return 300 + ret; }
+
+  std::cout << "Testing ThreadPool..." << std::endl;
+  if ((ret = TestThreadPool(false)) != 0) { return 400 + ret; }
+  if ((ret = TestThreadPool(true)) != 0) { return 410 + ret; }
+  if ((ret = TestThreadPoolPriority()) != 0) { return 420 + ret; }
+
+  std::cout << "Success!" << std::endl;
+  return 0;
+}
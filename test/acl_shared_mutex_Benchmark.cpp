@@ -0,0 +1,137 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <shared_mutex.h>
+
+/// @brief How long each configuration runs
+static const std::chrono::milliseconds g_runTime(500);
+
+/// @brief Time between writer acquisitions
+static const std::chrono::microseconds g_writePeriod(1000);
+
+/// @brief Keeps the protected reads from being optimized away
+static std::atomic<uint64_t> g_sink(0);
+
+/// @brief The reader-count-under-a-mutex lock acl::shared_mutex used to be,
+///        kept here as the baseline
+class LegacySharedMutex
+{
+  std::mutex m_read;
+  std::mutex m_mutex;
+  std::atomic_int readers;
+
+public:
+  LegacySharedMutex() : readers(0) {}
+  void lock() { m_mutex.lock(); }
+  void unlock() { m_mutex.unlock(); }
+  void lock_shared()
+  {
+    m_read.lock();
+    readers++;
+    if (readers == 1) m_mutex.lock();
+    m_read.unlock();
+  }
+  void unlock_shared()
+  {
+    m_read.lock();
+    readers--;
+    if (!readers) m_mutex.unlock();
+    m_read.unlock();
+  }
+};
+
+/// @brief Result of one benchmark run
+struct Result
+{
+  double readsPerSec;     //!< Shared acquisitions per second, all readers
+  double writeWaitUs;     //!< Average time the writer waited for the lock,
+                          //!< capped by the run time if it was starved
+};
+
+/// @brief Runs reader threads in a tight lock_shared/unlock_shared loop
+///        while one writer periodically takes the lock exclusively.
+/// @param [in] readers Number of reader threads
+template<typename Mutex> Result BenchmarkMutex(unsigned readers)
+{
+  Mutex mutex;
+  std::atomic_bool done(false);
+  std::atomic<uint64_t> reads(0);
+  uint64_t shared = 0;
+  std::vector<std::thread> threads;
+
+  for (unsigned r = 0; r < readers; r++) {
+    threads.emplace_back([&] {
+      uint64_t local = 0;
+      uint64_t sink = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        mutex.lock_shared();
+        sink += shared;
+        mutex.unlock_shared();
+        local++;
+      }
+      reads += local;
+      g_sink += sink;
+    });
+  }
+
+  // Readers stop on a timer rather than when the writer is done, so a
+  // starved writer cannot stretch the run
+  std::thread timer([&done] {
+    std::this_thread::sleep_for(g_runTime);
+    done = true;
+  });
+
+  uint64_t writes = 0;
+  std::chrono::duration<double, std::micro> waited(0);
+  auto start = std::chrono::steady_clock::now();
+  while (!done) {
+    auto before = std::chrono::steady_clock::now();
+    mutex.lock();
+    waited += std::chrono::steady_clock::now() - before;
+    shared++;
+    mutex.unlock();
+    writes++;
+    std::this_thread::sleep_for(g_writePeriod);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  timer.join();
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  Result result;
+  result.readsPerSec = reads / elapsed.count();
+  result.writeWaitUs = writes ? waited.count() / writes : 0;
+  return result;
+}
+
+int main()
+{
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Shared lock throughput with one writer every "
+            << g_writePeriod.count() << "us, " << std::thread::hardware_concurrency()
+            << " hardware threads" << std::endl;
+  std::cout << std::setw(8) << "readers"
+            << std::setw(18) << "legacy Mreads/s" << std::setw(16) << "legacy wait us"
+            << std::setw(18) << "acl Mreads/s" << std::setw(16) << "acl wait us" << std::endl;
+
+  for (unsigned readers = 1; readers <= 64; readers *= 2) {
+    Result legacy = BenchmarkMutex<LegacySharedMutex>(readers);
+    Result current = BenchmarkMutex<acl::shared_mutex>(readers);
+    std::cout << std::setw(8) << readers
+              << std::setw(18) << legacy.readsPerSec / 1e6 << std::setw(16) << legacy.writeWaitUs
+              << std::setw(18) << current.readsPerSec / 1e6 << std::setw(16) << current.writeWaitUs
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,327 @@
+/**
+ *    \copyright Copyright 2021 Aqueti, Inc. All rights reserved.
+ *    \license This project is released under the MIT Public License.
+**/
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <LockStats.h>
+#include <shared_mutex.h>
+
+/// @brief Checks exclusion between readers and writers under contention
+/// @return 0 on success, unique error code on failure.
+int TestExclusion()
+{
+  acl::shared_mutex mutex;
+  std::atomic_int readers(0);
+  std::atomic_int writers(0);
+  std::atomic_int violations(0);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 6; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 2000; i++) {
+        if (t < 2) {
+          std::lock_guard<acl::shared_mutex> lock(mutex);
+          if (writers++ != 0 || readers != 0) {
+            violations++;
+          }
+          writers--;
+        } else {
+          acl::shared_lock lock(mutex);
+          readers++;
+          if (writers != 0) {
+            violations++;
+          }
+          readers--;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  if (violations != 0) {
+    std::cerr << violations << " exclusion violations" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// @brief Checks that a writer waiting on a long read section sleeps
+///        instead of spinning, and still gets the lock when the reader leaves
+/// @return 0 on success, unique error code on failure.
+int TestWriterSleeps()
+{
+  acl::shared_mutex mutex;
+  std::atomic_bool held(false);
+  std::chrono::milliseconds hold(300);
+
+  std::thread reader([&] {
+    acl::shared_lock lock(mutex);
+    held = true;
+    std::this_thread::sleep_for(hold);
+  });
+  while (!held) {
+    std::this_thread::yield();
+  }
+
+  // The reader sleeps, so nearly all CPU time here would be the writer's
+  std::clock_t cpuStart = std::clock();
+  auto start = std::chrono::steady_clock::now();
+  mutex.lock();
+  auto waited = std::chrono::steady_clock::now() - start;
+  double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+  mutex.unlock();
+  reader.join();
+
+  if (waited < hold / 2) {
+    std::cerr << "Writer did not wait for the reader" << std::endl;
+    return 1;
+  }
+  if (cpuMs > 100) {
+    std::cerr << "Writer used " << cpuMs << " ms of CPU waiting for a reader" << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+/// @brief Checks that timed locks give up at their deadline and succeed
+///        once the lock is free
+/// @return 0 on success, unique error code on failure.
+int TestTimedLocks()
+{
+  acl::shared_mutex mutex;
+  std::chrono::milliseconds timeout(20);
+
+  mutex.lock_shared();
+  auto start = std::chrono::steady_clock::now();
+  if (mutex.try_lock_for(timeout)) {
+    std::cerr << "Locked exclusively while a reader held the lock" << std::endl;
+    return 1;
+  }
+  if (std::chrono::steady_clock::now() - start < timeout) {
+    std::cerr << "try_lock_for returned before its timeout" << std::endl;
+    return 2;
+  }
+  mutex.unlock_shared();
+
+  mutex.lock();
+  bool sharedTimedOut = true;
+  std::thread reader([&] {
+    acl::shared_lock lock(mutex, std::chrono::milliseconds(20));
+    sharedTimedOut = !lock.owns_lock() &&
+        !mutex.try_lock_shared_until(std::chrono::system_clock::now() + std::chrono::milliseconds(20));
+  });
+  reader.join();
+  if (!sharedTimedOut) {
+    std::cerr << "Shared lock acquired while a writer held the lock" << std::endl;
+    return 3;
+  }
+  mutex.unlock();
+
+  if (!mutex.try_lock_until(std::chrono::steady_clock::now() + timeout)) {
+    std::cerr << "try_lock_until failed on a free lock" << std::endl;
+    return 4;
+  }
+  mutex.unlock();
+
+  {
+    acl::shared_lock lock(mutex, std::defer_lock);
+    if (!lock.try_lock_for(timeout) || !lock.owns_lock()) {
+      std::cerr << "shared_lock::try_lock_for failed on a free lock" << std::endl;
+      return 5;
+    }
+
+    // Relocking an owned lock must neither take a second count nor drop ownership
+    bool threw = false;
+    try {
+      lock.try_lock_until(std::chrono::steady_clock::now() + timeout);
+    } catch (const std::system_error&) {
+      threw = true;
+    }
+    if (!threw || !lock.owns_lock()) {
+      std::cerr << "shared_lock relocked an owned lock" << std::endl;
+      return 6;
+    }
+  }
+  if (!mutex.try_lock()) {
+    std::cerr << "shared_lock left its reader count behind" << std::endl;
+    return 7;
+  }
+  mutex.unlock();
+
+  // A reader that backed off from a writer must not wait out an upgrader
+  // that holds m_mutex without blocking readers
+  mutex.lock();
+  bool gotShared = false;
+  std::chrono::steady_clock::duration sharedWait;
+  std::thread waiter([&] {
+    auto start = std::chrono::steady_clock::now();
+    gotShared = mutex.try_lock_shared_for(std::chrono::milliseconds(300));
+    sharedWait = std::chrono::steady_clock::now() - start;
+    if (gotShared) {
+      mutex.unlock_shared();
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  mutex.unlock_and_lock_upgrade();
+  waiter.join();
+  mutex.unlock_upgrade();
+  if (!gotShared || sharedWait > std::chrono::milliseconds(200)) {
+    std::cerr << "Timed shared lock waited on an upgrader" << std::endl;
+    return 8;
+  }
+  return 0;
+}
+
+/// @brief Checks that an upgrade lock admits readers, excludes writers and
+///        upgrades to an exclusive lock
+/// @return 0 on success, unique error code on failure.
+int TestUpgradeLock()
+{
+  acl::shared_mutex mutex;
+  {
+    acl::upgrade_lock lock(mutex);
+    if (!mutex.try_lock_shared()) {
+      std::cerr << "Reader blocked by an upgrade lock" << std::endl;
+      return 1;
+    }
+    mutex.unlock_shared();
+
+    bool writerBlocked = false;
+    std::thread writer([&] { writerBlocked = !mutex.try_lock() && !mutex.try_lock_upgrade(); });
+    writer.join();
+    if (!writerBlocked) {
+      std::cerr << "Writer or second upgrader got past an upgrade lock" << std::endl;
+      return 2;
+    }
+
+    lock.upgrade();
+    if (!lock.is_exclusive() || mutex.try_lock_shared()) {
+      std::cerr << "Reader got past an upgraded lock" << std::endl;
+      return 3;
+    }
+  }
+
+  // Upgrading waits for readers that arrived first
+  std::atomic_bool readerDone(false);
+  bool upgradedEarly = false;
+  mutex.lock_shared();
+  std::thread upgrader([&] {
+    acl::upgrade_lock lock(mutex);
+    lock.upgrade();
+    upgradedEarly = !readerDone;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  readerDone = true;
+  mutex.unlock_shared();
+  upgrader.join();
+  if (upgradedEarly) {
+    std::cerr << "Upgraded while a reader held the lock" << std::endl;
+    return 4;
+  }
+
+  // Downgrades
+  mutex.lock();
+  mutex.unlock_and_lock_upgrade();
+  if (!mutex.try_lock_shared()) {
+    std::cerr << "Reader blocked after downgrade" << std::endl;
+    return 5;
+  }
+  mutex.unlock_shared();
+  mutex.unlock_upgrade_and_lock_shared();
+  if (mutex.try_lock()) {
+    std::cerr << "Writer got past a downgraded reader" << std::endl;
+    return 6;
+  }
+  mutex.unlock_shared();
+  if (!mutex.try_lock()) {
+    std::cerr << "Lock not free after all releases" << std::endl;
+    return 7;
+  }
+  mutex.unlock();
+  return 0;
+}
+
+/// @brief Checks that AclMutex counts acquisitions and contention and that
+///        the registry dumps it
+/// @return 0 on success, unique error code on failure.
+int TestLockStats()
+{
+  acl::AclMutex mutex("test");
+  mutex.set_name("stats \"test\"");
+
+  mutex.lock();
+  std::thread waiter([&] { std::lock_guard<acl::AclMutex> lock(mutex); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  mutex.unlock();
+  waiter.join();
+  if (!mutex.try_lock()) {
+    std::cerr << "AclMutex::try_lock failed on a free lock" << std::endl;
+    return 1;
+  }
+  mutex.unlock();
+
+  acl::LockStats& stats = mutex.stats();
+  if (stats.acquisitions != 3 || stats.contended != 1) {
+    std::cerr << "Counted " << stats.acquisitions << " acquisitions, " << stats.contended
+              << " contended; expected 3, 1" << std::endl;
+    return 2;
+  }
+  if (stats.maxWaitNs == 0 || stats.waitNs < stats.maxWaitNs || stats.maxHoldNs == 0) {
+    std::cerr << "Wait or hold time not recorded" << std::endl;
+    return 3;
+  }
+
+  std::ostringstream text, json;
+  acl::LockRegistry::instance().dump_text(text);
+  acl::LockRegistry::instance().dump_json(json);
+  if (text.str().find("stats \"test\"") == std::string::npos ||
+      json.str().find("\"name\": \"stats \\\"test\\\"\"") == std::string::npos) {
+    std::cerr << "Lock missing from registry dump:\n" << text.str() << json.str() << std::endl;
+    return 4;
+  }
+
+  acl::LockRegistry::instance().reset();
+  if (stats.acquisitions != 0 || stats.maxWaitNs != 0) {
+    std::cerr << "Registry reset did not clear counters" << std::endl;
+    return 5;
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    acl::AclMutex gone("gone");
+    gone.set_name("destroyed lock");
+    std::lock_guard<acl::AclMutex> lock(gone);
+  }
+  std::ostringstream after;
+  acl::LockRegistry::instance().dump_json(after);
+  if (after.str().find("destroyed lock") != std::string::npos) {
+    std::cerr << "Registry kept destroyed locks" << std::endl;
+    return 6;
+  }
+  return 0;
+}
+
+int main()
+{
+  int ret;
+
+  std::cout << "Testing shared_mutex..." << std::endl;
+  if ((ret = TestExclusion()) != 0) { return ret; }
+  if ((ret = TestTimedLocks()) != 0) { return 10 + ret; }
+  if ((ret = TestUpgradeLock()) != 0) { return 20 + ret; }
+  if ((ret = TestLockStats()) != 0) { return 30 + ret; }
+  if ((ret = TestWriterSleeps()) != 0) { return 40 + ret; }
+
+  std::cout << "Success!" << std::endl;
+  return 0;
+}